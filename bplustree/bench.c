@@ -0,0 +1,986 @@
+// B+ tree benchmark.
+//
+// Runs insert, search and range-scan workloads over several instantiations
+// of DEFINE_BTREE and prints one CSV row per (tree, workload, size, op):
+//
+//   tree,order,leaf_keys,workload,n,op,ops,ops_per_sec,p50_ns,p99_ns,
+//   p999_ns,bytes_per_key,height
+//
+// Workloads pick the keys that are inserted and then looked up:
+//   seq     - 0, 1, ..., n-1 in order; searches in the same order
+//   uniform - a random permutation of 0..n-1; searches uniform over it
+//   zipf    - n draws from a Zipfian (theta 0.99) over n keys scattered
+//             across 0..n-1; searches from the same distribution
+//   urls    - n distinct URL strings sharing a 31-byte scheme, host and path
+//             prefix, inserted in random order; searches uniform over them.
+//             Runs the string trees instead: DEFINE_BTREE over const char *
+//             with strcmp against DEFINE_BTREE_STR (strtree.h)
+//   kernels - the node search kernels of search.h alone, on one in-cache
+//             node of ORDER-1 keys for the ORDERs of the bench_order*
+//             trees, 32- and 64-bit keys, n uniform probes. Rows are
+//             named <kernel>_i<bits>: scalar (the early-exit loop trees
+//             without BTREE_OPT_INT_KEYS run), branchless (binary search,
+//             then compare-and-add), sse2 and avx2 (the same with vector
+//             compares; sse2 is 32-bit only, avx2 needs the CPU). leaf_keys
+//             is the node's key count and there are no latency columns
+//   churn   - steady-state erase/insert on bench_churn (256-byte arena
+//             nodes) under each merge threshold of
+//             name##_set_merge_thresholds: half, quarter (the default) and
+//             0. Ops, with the threshold as suffix:
+//               uniform_* - n random keys out of 0..2n-1 loaded, then n
+//                           pairs of erasing a random present key and
+//                           inserting a random absent one
+//               boundary_* - keys 0..n-1 loaded in order, then n/2 times
+//                           erase and re-insert a random neighbouring pair
+//               erase90_* - erasing 90% of the uniform tree afterwards
+//             ops_per_sec counts pairs (uniform) or single erases and
+//             inserts; bytes_per_key and height are taken after the op
+//   startup - time to a first answer on intinttree over the uniform keys,
+//             BENCH_STARTUP_REPS times each: rebuild_insert (inserts in
+//             random order) and rebuild_bulk (name##_bulk_load from sorted
+//             entries) against snapshot_open and snapshot_open_verify
+//             (name##_snapshot_open without and with the body checksum),
+//             each followed by one lookup. snapshot_write is the write
+//             plus fsync and snapshot_search is n lookups on the mapping.
+//             The snapshot is a tmpfile() that stays in the page cache, so
+//             opens do not include reading it from disk. Latency columns
+//             are per rep; bytes_per_key is the tree's node memory or the
+//             file size
+//   parallel - the parallel.h operations on intinttree over the uniform
+//             keys against their serial counterparts, BENCH_PARALLEL_REPS
+//             times each: bulk_load and bulk_load_parallel_t<threads>
+//             from sorted entries, iterate and parallel_scan_t<threads>
+//             summing every value, for 1, 2, 4 and 8 threads. ops counts
+//             entries; latency columns are per rep
+// Inserts go through name##_upsert, so repeated Zipfian keys replace
+// instead of piling up. search_batch looks up the same keys as search
+// through name##_search_batch, BENCH_BATCH_LEN at a time; its latency
+// columns are per key, from the time of each sampled batch. A scan is a
+// lower_bound plus BENCH_SCAN_LEN steps.
+//
+// ops_per_sec comes from an untimed pass over every op. Latency
+// percentiles come from a second pass that times every op with
+// clock_gettime, so they include the timer's own cost (a few tens of ns).
+// bytes_per_key counts node memory only, not the entries; for
+// DEFINE_BTREE_STR it includes the separator strings.
+//
+// usage: bplustree_bench [-n size[,size...]] [-w workload[,workload...]]
+//                        [-s seed]
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "structures/bplustree/int_int_bplustree.h"
+#include "structures/bplustree/parallel.h"
+#include "structures/bplustree/snapshot.h"
+#include "structures/bplustree/strtree.h"
+
+#define BENCH_SCAN_LEN      100
+#define BENCH_BATCH_LEN     1024
+#define BENCH_STARTUP_REPS  3
+#define BENCH_PARALLEL_REPS 3
+#define BENCH_MAX_SAMPLES   (1 << 20)
+
+DEFINE_BTREE(bench_order4, IntIntBPlusTree, int, key, 4, CMP_INT)
+DEFINE_BTREE(bench_order16, IntIntBPlusTree, int, key, 16, CMP_INT)
+DEFINE_BTREE(bench_order64, IntIntBPlusTree, int, key, 64, CMP_INT)
+DEFINE_BTREE(bench_order256, IntIntBPlusTree, int, key, 256, CMP_INT)
+DEFINE_BTREE_SIZED_OPTS(bench_page, IntIntBPlusTree, int, key, 4096, CMP_INT,
+                        BTREE_OPT_INT_KEYS | BTREE_OPT_ARENA)
+/* intinttree with arena nodes, whose live counts the churn workload reads */
+DEFINE_BTREE_SIZED_OPTS(bench_churn, IntIntBPlusTree, int, key, 256, CMP_INT,
+                        BTREE_OPT_INT_KEYS | BTREE_OPT_ARENA)
+/* intinttree plus subtree counts, for the cost of keeping them */
+DEFINE_BTREE_SIZED_OPTS(bench_counts, IntIntBPlusTree, int, key, 256, CMP_INT,
+                        BTREE_OPT_INT_KEYS | BTREE_OPT_COUNTS)
+
+typedef struct {
+  const char *key;
+  int         value;
+} UrlEntry;
+
+/* a typedef so that the tree's const key_type * means const pointer */
+typedef const char *url_key;
+
+#define CMP_STR(a, b) strcmp((a), (b))
+
+DEFINE_BTREE_SIZED(bench_strcmp256, UrlEntry, url_key, key, 256, CMP_STR)
+DEFINE_BTREE_SIZED(bench_strcmp512, UrlEntry, url_key, key, 512, CMP_STR)
+DEFINE_BTREE_STR(bench_strkey256, UrlEntry, key, 256)
+DEFINE_BTREE_STR(bench_strkey512, UrlEntry, key, 512)
+
+typedef enum {
+  WL_SEQ,
+  WL_UNIFORM,
+  WL_ZIPF,
+  WL_URLS,
+  WL_KERNELS,
+  WL_CHURN,
+  WL_STARTUP,
+  WL_PARALLEL,
+  WL_COUNT
+} workload;
+
+static const char *const workload_names[WL_COUNT] = {
+    "seq", "uniform", "zipf", "urls", "kernels", "churn", "startup",
+    "parallel"};
+
+#define BENCH_URL_BYTES 64
+
+typedef struct {
+  const char      *workload;
+  size_t           n;
+  IntIntBPlusTree *entries;     /* n entries, keys in insert order */
+  int             *search_keys; /* n keys to look up */
+  uint64_t        *samples;     /* per-op latencies, BENCH_MAX_SAMPLES */
+  UrlEntry        *urls;        /* urls workload: n entries, insert order */
+  const char     **url_search;  /* n URLs to look up */
+  char            *url_bytes;   /* n strings of BENCH_URL_BYTES */
+} bench_run;
+
+static uint64_t bench_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t bench_rng_state;
+
+static uint64_t bench_rand(void) {
+  /* xorshift64* */
+  bench_rng_state ^= bench_rng_state >> 12;
+  bench_rng_state ^= bench_rng_state << 25;
+  bench_rng_state ^= bench_rng_state >> 27;
+  return bench_rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static double bench_rand_unit(void) {
+  return (double)(bench_rand() >> 11) / (double)(1ULL << 53);
+}
+
+// Zipfian ranks in [0, n) with P(rank) ~ 1 / (rank+1)^theta, from Gray et
+// al., "Quickly Generating Billion-Record Synthetic Databases".
+typedef struct {
+  size_t n;
+  double theta, alpha, zetan, eta;
+} zipf_gen;
+
+static void zipf_init(zipf_gen *z, size_t n, double theta) {
+  double zeta2 = 0;
+  z->zetan     = 0;
+  for (size_t i = 1; i <= n; ++i) {
+    z->zetan += 1.0 / pow((double)i, theta);
+    if (i == 2) zeta2 = z->zetan;
+  }
+  z->n     = n;
+  z->theta = theta;
+  z->alpha = 1.0 / (1.0 - theta);
+  z->eta   = (1.0 - pow(2.0 / (double)n, 1.0 - theta)) /
+           (1.0 - zeta2 / z->zetan);
+}
+
+static size_t zipf_next(const zipf_gen *z) {
+  double u  = bench_rand_unit();
+  double uz = u * z->zetan;
+  if (uz < 1.0) return 0;
+  if (uz < 1.0 + pow(0.5, z->theta)) return z->n > 1 ? 1 : 0;
+  size_t r =
+      (size_t)((double)z->n * pow(z->eta * u - z->eta + 1.0, z->alpha));
+  return r < z->n ? r : z->n - 1;
+}
+
+/* spread hot ranks over the key space instead of clustering them at 0 */
+static int zipf_key(size_t rank, size_t n) {
+  uint64_t x = rank + 1;
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  return (int)(x % n);
+}
+
+static void bench_make_keys(bench_run *r, workload w) {
+  size_t   n = r->n;
+  zipf_gen z;
+  if (w == WL_ZIPF) zipf_init(&z, n, 0.99);
+  for (size_t i = 0; i < n; ++i) r->entries[i].key = (int)i;
+  if (w == WL_UNIFORM) {
+    for (size_t i = n - 1; i > 0; --i) {
+      size_t j          = bench_rand() % (i + 1);
+      int    k          = r->entries[i].key;
+      r->entries[i].key = r->entries[j].key;
+      r->entries[j].key = k;
+    }
+  }
+  for (size_t i = 0; i < n; ++i) {
+    r->entries[i].value = (int)i;
+    switch (w) {
+    case WL_SEQ:
+      r->search_keys[i] = (int)i;
+      break;
+    case WL_UNIFORM:
+      r->search_keys[i] = (int)(bench_rand() % n);
+      break;
+    default:
+      r->entries[i].key = zipf_key(zipf_next(&z), n);
+      r->search_keys[i] = zipf_key(zipf_next(&z), n);
+      break;
+    }
+  }
+}
+
+static void bench_make_urls(bench_run *r) {
+  static const char *const sections[] = {"books", "garden",  "kitchen",
+                                         "music", "outdoor", "toys"};
+  size_t                   n          = r->n;
+  for (size_t i = 0; i < n; ++i) {
+    char *u = r->url_bytes + i * BENCH_URL_BYTES;
+    /* an odd multiplier not divisible by 5 permutes [0, 10^10) */
+    unsigned long long id = i * 2654435761ULL % 10000000000ULL;
+    snprintf(u, BENCH_URL_BYTES, "https://www.shop.example.com/p/%s/%010llu",
+             sections[zipf_key(i, 6)], id);
+    r->urls[i] = (UrlEntry){.key = u, .value = (int)i};
+  }
+  for (size_t i = n - 1; i > 0; --i) {
+    size_t   j = bench_rand() % (i + 1);
+    UrlEntry e = r->urls[i];
+    r->urls[i] = r->urls[j];
+    r->urls[j] = e;
+  }
+  for (size_t i = 0; i < n; ++i)
+    r->url_search[i] = r->urls[bench_rand() % n].key;
+}
+
+static int bench_cmp_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static uint64_t bench_percentile(const uint64_t *sorted, size_t n, double p) {
+  if (n == 0) return 0;
+  size_t i = (size_t)(p * (double)(n - 1) + 0.5);
+  return sorted[i];
+}
+
+static void bench_report(const char *tree, int order, int leaf_keys,
+                         const bench_run *r, const char *op, size_t ops,
+                         uint64_t elapsed_ns, size_t nsamples,
+                         double bytes_per_key, int height) {
+  qsort(r->samples, nsamples, sizeof(uint64_t), bench_cmp_u64);
+  printf("%s,%d,%d,%s,%zu,%s,%zu,%.0f,%llu,%llu,%llu,%.2f,%d\n", tree, order,
+         leaf_keys, r->workload, r->n, op, ops,
+         elapsed_ns ? (double)ops * 1e9 / (double)elapsed_ns : 0.0,
+         (unsigned long long)bench_percentile(r->samples, nsamples, 0.50),
+         (unsigned long long)bench_percentile(r->samples, nsamples, 0.99),
+         (unsigned long long)bench_percentile(r->samples, nsamples, 0.999),
+         bytes_per_key, height);
+}
+
+// Runner for one instantiation: name##_bench(run) builds a tree from
+// run->entries twice (once for throughput, once timing every insert), then
+// measures searches and scans on it.
+#define BENCH_TREE(name)                                                       \
+  static void name##_nodes(name##_node *n, size_t *leaves, size_t *inners) {   \
+    if (n->is_leaf) {                                                          \
+      ++*leaves;                                                               \
+      return;                                                                  \
+    }                                                                          \
+    ++*inners;                                                                 \
+    for (int i = 0; i <= n->nkeys; ++i)                                        \
+      name##_nodes(name##_as_inner(n)->children[i], leaves, inners);           \
+  }                                                                            \
+                                                                               \
+  static int name##_height(const name *t) {                                    \
+    int h = 0;                                                                 \
+    for (name##_node *n = t->root; n;                                          \
+         n = n->is_leaf ? NULL : name##_as_inner(n)->children[0])              \
+      ++h;                                                                     \
+    return h;                                                                  \
+  }                                                                            \
+                                                                               \
+  static void name##_bench(bench_run *r) {                                     \
+    const char *tn      = #name;                                               \
+    size_t      n       = r->n;                                                \
+    size_t      stride  = n / BENCH_MAX_SAMPLES + 1;                           \
+    size_t      samples = 0;                                                   \
+    name        t;                                                             \
+                                                                               \
+    name##_init(&t);                                                           \
+    uint64_t t0 = bench_now_ns();                                              \
+    for (size_t i = 0; i < n; ++i) name##_upsert(&t, &r->entries[i], NULL);    \
+    uint64_t insert_ns = bench_now_ns() - t0;                                  \
+    name##_destroy(&t);                                                        \
+                                                                               \
+    name##_init(&t);                                                           \
+    for (size_t i = 0; i < n; ++i) {                                           \
+      if (i % stride) {                                                        \
+        name##_upsert(&t, &r->entries[i], NULL);                               \
+        continue;                                                              \
+      }                                                                        \
+      t0 = bench_now_ns();                                                     \
+      name##_upsert(&t, &r->entries[i], NULL);                                 \
+      r->samples[samples++] = bench_now_ns() - t0;                             \
+    }                                                                          \
+                                                                               \
+    size_t leaves = 0, inners = 0, keys = 0;                                   \
+    if (t.root) name##_nodes(t.root, &leaves, &inners);                        \
+    for (name##_cursor c = name##_cursor_first(&t); name##_cursor_valid(&c);   \
+         name##_cursor_next(&c))                                               \
+      ++keys;                                                                  \
+    double bpk = keys ? (double)(leaves * sizeof(name##_leaf) +                \
+                                 inners * name##_INNER_BYTES) /                \
+                            (double)keys                                       \
+                      : 0.0;                                                   \
+    int height = name##_height(&t);                                            \
+    bench_report(tn, name##_ORDER, name##_LEAF_KEYS, r, "insert", n,           \
+                 insert_ns, samples, bpk, height);                             \
+                                                                               \
+    /* searches; found counts keep the loop from being optimised out */        \
+    volatile size_t found = 0;                                                 \
+    t0                    = bench_now_ns();                                    \
+    for (size_t i = 0; i < n; ++i)                                             \
+      found += name##_search(&t, r->search_keys[i]) != NULL;                   \
+    uint64_t search_ns = bench_now_ns() - t0;                                  \
+    samples            = 0;                                                    \
+    for (size_t i = 0; i < n; i += stride) {                                   \
+      t0 = bench_now_ns();                                                     \
+      found += name##_search(&t, r->search_keys[i]) != NULL;                   \
+      r->samples[samples++] = bench_now_ns() - t0;                             \
+    }                                                                          \
+    bench_report(tn, name##_ORDER, name##_LEAF_KEYS, r, "search", n,           \
+                 search_ns, samples, bpk, height);                             \
+                                                                               \
+    /* the same lookups in batches; every stride-th batch is timed alone */    \
+    IntIntBPlusTree *out[BENCH_BATCH_LEN];                                     \
+    t0 = bench_now_ns();                                                       \
+    for (size_t i = 0; i < n; i += BENCH_BATCH_LEN) {                          \
+      size_t len = n - i < BENCH_BATCH_LEN ? n - i : BENCH_BATCH_LEN;          \
+      name##_search_batch(&t, &r->search_keys[i], len, out);                   \
+      found += out[len - 1] != NULL;                                           \
+    }                                                                          \
+    uint64_t batch_ns = bench_now_ns() - t0;                                   \
+    samples           = 0;                                                     \
+    for (size_t i = 0; i < n; i += BENCH_BATCH_LEN * stride) {                 \
+      size_t len = n - i < BENCH_BATCH_LEN ? n - i : BENCH_BATCH_LEN;          \
+      t0         = bench_now_ns();                                             \
+      name##_search_batch(&t, &r->search_keys[i], len, out);                   \
+      r->samples[samples++] = (bench_now_ns() - t0) / len;                     \
+      found += out[len - 1] != NULL;                                           \
+    }                                                                          \
+    bench_report(tn, name##_ORDER, name##_LEAF_KEYS, r, "search_batch", n,     \
+                 batch_ns, samples, bpk, height);                              \
+                                                                               \
+    /* short range scans from the same keys, fewer of them */                  \
+    size_t scans = n / 16 + 1;                                                 \
+    t0           = bench_now_ns();                                             \
+    for (size_t i = 0; i < scans; ++i) {                                       \
+      name##_cursor c = name##_lower_bound(&t, r->search_keys[i]);             \
+      for (int j = 0; j < BENCH_SCAN_LEN && name##_cursor_valid(&c); ++j) {    \
+        found += name##_cursor_entry(&c)->value;                               \
+        name##_cursor_next(&c);                                                \
+      }                                                                        \
+    }                                                                          \
+    uint64_t scan_ns = bench_now_ns() - t0;                                    \
+    samples          = 0;                                                      \
+    for (size_t i = 0; i < scans; i += stride) {                               \
+      t0              = bench_now_ns();                                        \
+      name##_cursor c = name##_lower_bound(&t, r->search_keys[i]);             \
+      for (int j = 0; j < BENCH_SCAN_LEN && name##_cursor_valid(&c); ++j) {    \
+        found += name##_cursor_entry(&c)->value;                               \
+        name##_cursor_next(&c);                                                \
+      }                                                                        \
+      r->samples[samples++] = bench_now_ns() - t0;                             \
+    }                                                                          \
+    bench_report(tn, name##_ORDER, name##_LEAF_KEYS, r, "scan", scans,         \
+                 scan_ns, samples, bpk, height);                               \
+    name##_destroy(&t);                                                        \
+  }
+
+BENCH_TREE(bench_order4)
+BENCH_TREE(bench_order16)
+BENCH_TREE(bench_order64)
+BENCH_TREE(bench_order256)
+BENCH_TREE(intinttree)
+BENCH_TREE(bench_page)
+BENCH_TREE(bench_counts)
+
+static void (*const bench_trees[])(bench_run *) = {
+    bench_order4_bench, bench_order16_bench, bench_order64_bench,
+    bench_order256_bench, intinttree_bench, bench_page_bench,
+    bench_counts_bench,
+};
+
+DEFINE_BTREE_SNAPSHOT(intinttree)
+
+static void bench_startup_report(bench_run *r, const char *op,
+                                 uint64_t total_ns, double bpk, int height) {
+  bench_report("intinttree", intinttree_ORDER, intinttree_LEAF_KEYS, r, op,
+               BENCH_STARTUP_REPS, total_ns, BENCH_STARTUP_REPS, bpk, height);
+}
+
+/* bytes per key and height of a built tree */
+static double bench_intint_memory(const intinttree *t, size_t n, int *height) {
+  size_t leaves = 0, inners = 0;
+  if (t->root) intinttree_nodes(t->root, &leaves, &inners);
+  *height = intinttree_height(t);
+  return (double)(leaves * sizeof(intinttree_leaf) +
+                  inners * intinttree_INNER_BYTES) /
+         (double)n;
+}
+
+static void bench_startup(bench_run *r) {
+  size_t            n      = r->n;
+  IntIntBPlusTree **sorted = malloc(n * sizeof(*sorted));
+  FILE             *f      = tmpfile();
+  if (!sorted || !f) {
+    fprintf(stderr, "startup: out of memory or no tmpfile\n");
+    exit(1);
+  }
+  /* uniform keys are a permutation of 0..n-1 */
+  for (size_t i = 0; i < n; ++i) sorted[r->entries[i].key] = &r->entries[i];
+  int             fd    = fileno(f);
+  int             key   = r->search_keys[0];
+  volatile size_t found = 0;
+  uint64_t        total = 0, t0;
+  intinttree      t;
+  int             height;
+  double          bpk = 0;
+
+  for (int rep = 0; rep < BENCH_STARTUP_REPS; ++rep) {
+    t0 = bench_now_ns();
+    intinttree_init(&t);
+    for (size_t i = 0; i < n; ++i) intinttree_insert(&t, &r->entries[i]);
+    found += intinttree_search(&t, key) != NULL;
+    r->samples[rep] = bench_now_ns() - t0;
+    total += r->samples[rep];
+    bpk = bench_intint_memory(&t, n, &height);
+    intinttree_destroy(&t);
+  }
+  bench_startup_report(r, "rebuild_insert", total, bpk, height);
+
+  total = 0;
+  for (int rep = 0; rep < BENCH_STARTUP_REPS; ++rep) {
+    t0 = bench_now_ns();
+    intinttree_init(&t);
+    intinttree_bulk_load(&t, sorted, n, 1.0);
+    found += intinttree_search(&t, key) != NULL;
+    r->samples[rep] = bench_now_ns() - t0;
+    total += r->samples[rep];
+    bpk = bench_intint_memory(&t, n, &height);
+    if (rep + 1 < BENCH_STARTUP_REPS) intinttree_destroy(&t);
+  }
+  bench_startup_report(r, "rebuild_bulk", total, bpk, height);
+
+  /* t stays loaded as the source of the snapshot */
+  total = 0;
+  for (int rep = 0; rep < BENCH_STARTUP_REPS; ++rep) {
+    t0 = bench_now_ns();
+    if (intinttree_snapshot_write(&t, fd) != 0 || fsync(fd) != 0) {
+      perror("snapshot_write");
+      exit(1);
+    }
+    r->samples[rep] = bench_now_ns() - t0;
+    total += r->samples[rep];
+  }
+  intinttree_destroy(&t);
+
+  intinttree_snapshot s;
+  double              file_bpk = 0;
+  height                       = 0;
+  if (intinttree_snapshot_open(&s, fd, false) == 0) {
+    file_bpk = (double)s.bytes / (double)n;
+    height   = s.height;
+    intinttree_snapshot_close(&s);
+  }
+  bench_startup_report(r, "snapshot_write", total, file_bpk, height);
+
+  for (int verify = 0; verify < 2; ++verify) {
+    total = 0;
+    for (int rep = 0; rep < BENCH_STARTUP_REPS; ++rep) {
+      t0 = bench_now_ns();
+      if (intinttree_snapshot_open(&s, fd, verify) != 0) {
+        perror("snapshot_open");
+        exit(1);
+      }
+      found += intinttree_snapshot_search(&s, key) != NULL;
+      r->samples[rep] = bench_now_ns() - t0;
+      total += r->samples[rep];
+      intinttree_snapshot_close(&s);
+    }
+    bench_startup_report(r, verify ? "snapshot_open_verify" : "snapshot_open",
+                         total, file_bpk, height);
+  }
+
+  intinttree_snapshot_open(&s, fd, false);
+  t0 = bench_now_ns();
+  for (size_t i = 0; i < n; ++i)
+    found += intinttree_snapshot_search(&s, r->search_keys[i]) != NULL;
+  bench_report("intinttree", intinttree_ORDER, intinttree_LEAF_KEYS, r,
+               "snapshot_search", n, bench_now_ns() - t0, 0, file_bpk,
+               height);
+  intinttree_snapshot_close(&s);
+  fclose(f);
+  free(sorted);
+}
+
+// Runner for the urls workload, same ops as BENCH_TREE over r->urls.
+// EXTRA_BYTES(t) is node memory held outside the nodes.
+#define BENCH_STR_TREE(name, EXTRA_BYTES)                                      \
+  static void name##_str_nodes(name##_node *n, size_t *leaves,                 \
+                               size_t *inners) {                               \
+    if (n->is_leaf) {                                                          \
+      ++*leaves;                                                               \
+      return;                                                                  \
+    }                                                                          \
+    ++*inners;                                                                 \
+    for (int i = 0; i <= n->nkeys; ++i)                                        \
+      name##_str_nodes(name##_as_inner(n)->children[i], leaves, inners);       \
+  }                                                                            \
+                                                                               \
+  static void name##_bench(bench_run *r) {                                     \
+    const char *tn      = #name;                                               \
+    size_t      n       = r->n;                                                \
+    size_t      stride  = n / BENCH_MAX_SAMPLES + 1;                           \
+    size_t      samples = 0;                                                   \
+    name        t;                                                             \
+                                                                               \
+    name##_init(&t);                                                           \
+    uint64_t t0 = bench_now_ns();                                              \
+    for (size_t i = 0; i < n; ++i) name##_insert(&t, &r->urls[i]);             \
+    uint64_t insert_ns = bench_now_ns() - t0;                                  \
+    name##_destroy(&t);                                                        \
+                                                                               \
+    name##_init(&t);                                                           \
+    for (size_t i = 0; i < n; ++i) {                                           \
+      if (i % stride) {                                                        \
+        name##_insert(&t, &r->urls[i]);                                        \
+        continue;                                                              \
+      }                                                                        \
+      t0 = bench_now_ns();                                                     \
+      name##_insert(&t, &r->urls[i]);                                          \
+      r->samples[samples++] = bench_now_ns() - t0;                             \
+    }                                                                          \
+                                                                               \
+    size_t leaves = 0, inners = 0, height = 0;                                 \
+    name##_str_nodes(t.root, &leaves, &inners);                                \
+    for (name##_node *p = t.root; p;                                           \
+         p = p->is_leaf ? NULL : name##_as_inner(p)->children[0])              \
+      ++height;                                                                \
+    double bpk = (double)(leaves * sizeof(name##_leaf) +                       \
+                          inners * sizeof(name##_inner) + EXTRA_BYTES(t)) /    \
+                 (double)n;                                                    \
+    bench_report(tn, name##_ORDER, name##_LEAF_KEYS, r, "insert", n,           \
+                 insert_ns, samples, bpk, (int)height);                        \
+                                                                               \
+    volatile size_t found = 0;                                                 \
+    t0                    = bench_now_ns();                                    \
+    for (size_t i = 0; i < n; ++i)                                             \
+      found += name##_search(&t, r->url_search[i]) != NULL;                    \
+    uint64_t search_ns = bench_now_ns() - t0;                                  \
+    samples            = 0;                                                    \
+    for (size_t i = 0; i < n; i += stride) {                                   \
+      t0 = bench_now_ns();                                                     \
+      found += name##_search(&t, r->url_search[i]) != NULL;                    \
+      r->samples[samples++] = bench_now_ns() - t0;                             \
+    }                                                                          \
+    bench_report(tn, name##_ORDER, name##_LEAF_KEYS, r, "search", n,           \
+                 search_ns, samples, bpk, (int)height);                        \
+                                                                               \
+    size_t scans = n / 16 + 1;                                                 \
+    t0           = bench_now_ns();                                             \
+    for (size_t i = 0; i < scans; ++i) {                                       \
+      name##_cursor c = name##_lower_bound(&t, r->url_search[i]);              \
+      for (int j = 0; j < BENCH_SCAN_LEN && name##_cursor_valid(&c); ++j) {    \
+        found += name##_cursor_entry(&c)->value;                               \
+        name##_cursor_next(&c);                                                \
+      }                                                                        \
+    }                                                                          \
+    uint64_t scan_ns = bench_now_ns() - t0;                                    \
+    samples          = 0;                                                      \
+    for (size_t i = 0; i < scans; i += stride) {                               \
+      t0              = bench_now_ns();                                        \
+      name##_cursor c = name##_lower_bound(&t, r->url_search[i]);              \
+      for (int j = 0; j < BENCH_SCAN_LEN && name##_cursor_valid(&c); ++j) {    \
+        found += name##_cursor_entry(&c)->value;                               \
+        name##_cursor_next(&c);                                                \
+      }                                                                        \
+      r->samples[samples++] = bench_now_ns() - t0;                             \
+    }                                                                          \
+    bench_report(tn, name##_ORDER, name##_LEAF_KEYS, r, "scan", scans,         \
+                 scan_ns, samples, bpk, (int)height);                          \
+    name##_destroy(&t);                                                        \
+  }
+
+#define BENCH_NO_EXTRA(t)  ((void)(t), (size_t)0)
+#define BENCH_SEP_BYTES(t) ((t).seps.bytes)
+
+BENCH_STR_TREE(bench_strcmp256, BENCH_NO_EXTRA)
+BENCH_STR_TREE(bench_strcmp512, BENCH_NO_EXTRA)
+BENCH_STR_TREE(bench_strkey256, BENCH_SEP_BYTES)
+BENCH_STR_TREE(bench_strkey512, BENCH_SEP_BYTES)
+
+static void (*const bench_str_trees[])(bench_run *) = {
+    bench_strcmp256_bench,
+    bench_strcmp512_bench,
+    bench_strkey256_bench,
+    bench_strkey512_bench,
+};
+
+static double bench_churn_bpk(const bench_churn *t, size_t keys) {
+  size_t bytes = t->leaf_arena.live * sizeof(bench_churn_leaf) +
+                 t->inner_arena.live * bench_churn_INNER_BYTES;
+  return keys ? (double)bytes / (double)keys : 0.0;
+}
+
+static int bench_churn_height(const bench_churn *t) {
+  int h = 0;
+  for (bench_churn_node *n = t->root; n;
+       n = n->is_leaf ? NULL : bench_churn_as_inner(n)->children[0])
+    ++h;
+  return h;
+}
+
+static void bench_churn_report(const bench_churn *t, bench_run *r,
+                               const char *op, const char *mode, size_t ops,
+                               uint64_t ns, size_t keys) {
+  char name[32];
+  snprintf(name, sizeof(name), "%s_%s", op, mode);
+  bench_report("bench_churn", bench_churn_ORDER, bench_churn_LEAF_KEYS, r,
+               name, ops, ns, 0, bench_churn_bpk(t, keys),
+               bench_churn_height(t));
+}
+
+static void bench_churn_run(bench_run *r) {
+  static const char *const modes[]   = {"half", "quarter", "0"};
+  static const int         divisor[] = {2, 4, 0}; /* of capacity, 0 for 0 */
+  size_t                   n         = r->n;
+  IntIntBPlusTree         *entries   = malloc(2 * n * sizeof(*entries));
+  int                     *keys      = malloc(2 * n * sizeof(*keys));
+  if (!entries || !keys) {
+    fprintf(stderr, "out of memory for churn n=%zu\n", n);
+    exit(1);
+  }
+  for (size_t k = 0; k < 2 * n; ++k)
+    entries[k] = (IntIntBPlusTree){.key = (int)k, .value = (int)k};
+
+  for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+    int leaf_min  = divisor[m] ? bench_churn_LEAF_KEYS / divisor[m] : 0;
+    int inner_min = divisor[m] ? bench_churn_MAX_KEYS / divisor[m] : 0;
+
+    /* keys[0..n) are in the tree, keys[n..2n) are not */
+    for (size_t k = 0; k < 2 * n; ++k) keys[k] = (int)k;
+    for (size_t i = 2 * n - 1; i > 0; --i) {
+      size_t j = bench_rand() % (i + 1);
+      int    k = keys[i];
+      keys[i]  = keys[j];
+      keys[j]  = k;
+    }
+    bench_churn t;
+    bench_churn_init(&t);
+    bench_churn_set_merge_thresholds(&t, leaf_min, inner_min);
+    for (size_t i = 0; i < n; ++i)
+      bench_churn_insert(&t, &entries[keys[i]]);
+    uint64_t t0 = bench_now_ns();
+    for (size_t i = 0; i < n; ++i) {
+      size_t out = bench_rand() % n, in = n + bench_rand() % n;
+      bench_churn_erase(&t, keys[out]);
+      bench_churn_insert(&t, &entries[keys[in]]);
+      int k     = keys[out];
+      keys[out] = keys[in];
+      keys[in]  = k;
+    }
+    bench_churn_report(&t, r, "uniform", modes[m], n, bench_now_ns() - t0,
+                       n);
+
+    size_t drop = n - n / 10;
+    t0          = bench_now_ns();
+    for (size_t i = 0; i < drop; ++i) bench_churn_erase(&t, keys[i]);
+    bench_churn_report(&t, r, "erase90", modes[m], drop, bench_now_ns() - t0,
+                       n - drop);
+    bench_churn_destroy(&t);
+
+    bench_churn_init(&t);
+    bench_churn_set_merge_thresholds(&t, leaf_min, inner_min);
+    for (size_t k = 0; k < n; ++k) bench_churn_insert(&t, &entries[k]);
+    size_t pairs = n / 2;
+    t0           = bench_now_ns();
+    for (size_t i = 0; i < pairs && n > 1; ++i) {
+      int k = (int)(bench_rand() % (n - 1));
+      bench_churn_erase(&t, k);
+      bench_churn_erase(&t, k + 1);
+      bench_churn_insert(&t, &entries[k]);
+      bench_churn_insert(&t, &entries[k + 1]);
+    }
+    bench_churn_report(&t, r, "boundary", modes[m], 4 * pairs,
+                       bench_now_ns() - t0, n);
+    bench_churn_destroy(&t);
+  }
+  free(entries);
+  free(keys);
+}
+
+// Kernel variants for the kernels workload, each counting keys < x.
+#define BENCH_KERNEL_VARIANTS(bits)                                            \
+  static inline int bench_scalar_i##bits(const btree_key_i##bits *k, int n,    \
+                                         int##bits##_t x) {                    \
+    int i = 0;                                                                 \
+    while (i < n && k[i] < x) i++;                                             \
+    return i;                                                                  \
+  }                                                                            \
+                                                                               \
+  static inline int bench_branchless_i##bits(const btree_key_i##bits *k,       \
+                                             int n, int##bits##_t x) {         \
+    int base = btree_narrow_i##bits(k, &n, x);                                 \
+    return base + btree_scalar_count_lt_i##bits(k + base, n, x);               \
+  }
+
+BENCH_KERNEL_VARIANTS(32)
+BENCH_KERNEL_VARIANTS(64)
+
+#if BTREE_SEARCH_X86
+static inline int bench_sse2_i32(const btree_key_i32 *k, int n, int32_t x) {
+  int base = btree_narrow_i32(k, &n, x);
+  return base + btree_sse2_count_lt_i32(k + base, n, x);
+}
+
+static inline int bench_avx2_i32(const btree_key_i32 *k, int n, int32_t x) {
+  int base = btree_narrow_i32(k, &n, x);
+  return base + btree_avx2_count_lt_i32(k + base, n, x);
+}
+
+static inline int bench_avx2_i64(const btree_key_i64 *k, int n, int64_t x) {
+  int base = btree_narrow_i64(k, &n, x);
+  return base + btree_avx2_count_lt_i64(k + base, n, x);
+}
+#endif
+
+// Time bench_<kernel>_i<bits> over the probes and print its row. Keys are
+// 0, 2, 4, ... and probes fall in [-1, 2 * (ORDER-1)], so about half of
+// them hit a key and every slot is reached.
+#define BENCH_KERNEL_ROW(kernel, bits)                                         \
+  static void bench_row_##kernel##_i##bits(bench_run *r, int order) {          \
+    btree_key_i##bits keys[BENCH_KERNEL_MAX_ORDER];                            \
+    int               nk  = order - 1;                                         \
+    volatile int      sum = 0;                                                 \
+    for (int i = 0; i < nk; ++i) keys[i] = 2 * i;                              \
+    for (size_t i = 0; i < r->n; ++i)                                          \
+      r->search_keys[i] = (int)(bench_rand() % (uint64_t)(2 * nk + 2)) - 1;    \
+    uint64_t t0 = bench_now_ns();                                              \
+    for (size_t i = 0; i < r->n; ++i)                                          \
+      sum += bench_##kernel##_i##bits(keys, nk, r->search_keys[i]);            \
+    uint64_t ns = bench_now_ns() - t0;                                         \
+    bench_report(#kernel "_i" #bits, order, nk, r, "count_lt", r->n, ns, 0,    \
+                 bits / 8, 1);                                                 \
+  }
+
+#define BENCH_KERNEL_MAX_ORDER 256
+
+BENCH_KERNEL_ROW(scalar, 32)
+BENCH_KERNEL_ROW(scalar, 64)
+BENCH_KERNEL_ROW(branchless, 32)
+BENCH_KERNEL_ROW(branchless, 64)
+#if BTREE_SEARCH_X86
+BENCH_KERNEL_ROW(sse2, 32)
+BENCH_KERNEL_ROW(avx2, 32)
+BENCH_KERNEL_ROW(avx2, 64)
+#endif
+
+static void bench_kernels(bench_run *r) {
+  static const int orders[] = {4, 16, 64, 256};
+  for (size_t o = 0; o < sizeof(orders) / sizeof(orders[0]); ++o) {
+    bench_row_scalar_i32(r, orders[o]);
+    bench_row_branchless_i32(r, orders[o]);
+#if BTREE_SEARCH_X86
+    bench_row_sse2_i32(r, orders[o]);
+    if (btree_cpu_avx2()) bench_row_avx2_i32(r, orders[o]);
+#endif
+    bench_row_scalar_i64(r, orders[o]);
+    bench_row_branchless_i64(r, orders[o]);
+#if BTREE_SEARCH_X86
+    if (btree_cpu_avx2()) bench_row_avx2_i64(r, orders[o]);
+#endif
+  }
+}
+
+DEFINE_BTREE_PARALLEL(intinttree)
+
+static void bench_sum_iterate(IntIntBPlusTree *e, void *sum) {
+  *(long long *)sum += e->value;
+}
+
+static void bench_sum_visit(IntIntBPlusTree *e, void *acc, void *ctx) {
+  (void)ctx;
+  *(long long *)acc += e->value;
+}
+
+static void bench_sum_merge(void *into, const void *from, void *ctx) {
+  (void)ctx;
+  *(long long *)into += *(const long long *)from;
+}
+
+/* run one op BENCH_PARALLEL_REPS times on t and print its row: a bulk
+ * load from sorted or (scan) a sum over t, serial when nthreads is 0 */
+static void bench_parallel_op(bench_run *r, intinttree *t,
+                              IntIntBPlusTree **sorted, bool scan,
+                              int nthreads) {
+  static const long long zero  = 0;
+  volatile long long     sum   = 0;
+  uint64_t               total = 0;
+  int                    height;
+  for (int rep = 0; rep < BENCH_PARALLEL_REPS; ++rep) {
+    long long acc = 0;
+    uint64_t  t0  = bench_now_ns();
+    if (!scan && nthreads)
+      intinttree_bulk_load_parallel(t, sorted, r->n, 1.0, nthreads);
+    else if (!scan)
+      intinttree_bulk_load(t, sorted, r->n, 1.0);
+    else if (nthreads)
+      intinttree_parallel_scan(t, nthreads, sizeof(acc), &zero,
+                               bench_sum_visit, bench_sum_merge, NULL, &acc);
+    else
+      intinttree_iterate(t, bench_sum_iterate, &acc);
+    r->samples[rep] = bench_now_ns() - t0;
+    total += r->samples[rep];
+    sum += acc;
+  }
+  double bpk = bench_intint_memory(t, r->n, &height);
+  char   op[32];
+  if (nthreads)
+    snprintf(op, sizeof(op), "%s_t%d",
+             scan ? "parallel_scan" : "bulk_load_parallel", nthreads);
+  else
+    snprintf(op, sizeof(op), "%s", scan ? "iterate" : "bulk_load");
+  bench_report("intinttree", intinttree_ORDER, intinttree_LEAF_KEYS, r, op,
+               r->n * BENCH_PARALLEL_REPS, total, BENCH_PARALLEL_REPS, bpk,
+               height);
+}
+
+static void bench_parallel(bench_run *r) {
+  static const int  threads[] = {1, 2, 4, 8};
+  size_t            nt        = sizeof(threads) / sizeof(threads[0]);
+  IntIntBPlusTree **sorted    = malloc(r->n * sizeof(*sorted));
+  if (!sorted) {
+    fprintf(stderr, "parallel: out of memory for n=%zu\n", r->n);
+    exit(1);
+  }
+  /* uniform keys are a permutation of 0..n-1 */
+  for (size_t i = 0; i < r->n; ++i)
+    sorted[r->entries[i].key] = &r->entries[i];
+  intinttree t;
+  intinttree_init(&t);
+  bench_parallel_op(r, &t, sorted, false, 0);
+  for (size_t k = 0; k < nt; ++k)
+    bench_parallel_op(r, &t, sorted, false, threads[k]);
+  bench_parallel_op(r, &t, sorted, true, 0);
+  for (size_t k = 0; k < nt; ++k)
+    bench_parallel_op(r, &t, sorted, true, threads[k]);
+  intinttree_destroy(&t);
+  free(sorted);
+}
+
+/* parse "a,b,c" into sizes, returns the count */
+static size_t bench_parse_sizes(char *s, size_t *out, size_t cap) {
+  size_t count = 0;
+  for (char *tok = strtok(s, ","); tok && count < cap;
+       tok = strtok(NULL, ","))
+    out[count++] = strtoull(tok, NULL, 10);
+  return count;
+}
+
+int main(int argc, char **argv) {
+  size_t   sizes[16]         = {10000, 100000, 1000000};
+  size_t   nsizes            = 3;
+  bool     enabled[WL_COUNT];
+  uint64_t seed              = 42;
+  for (int w = 0; w < WL_COUNT; ++w) enabled[w] = true;
+
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+      nsizes = bench_parse_sizes(argv[++i], sizes, 16);
+    } else if (!strcmp(argv[i], "-w") && i + 1 < argc) {
+      memset(enabled, 0, sizeof(enabled));
+      for (char *tok = strtok(argv[++i], ","); tok; tok = strtok(NULL, ","))
+        for (int w = 0; w < WL_COUNT; ++w)
+          if (!strcmp(tok, workload_names[w])) enabled[w] = true;
+    } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+      seed = strtoull(argv[++i], NULL, 10);
+    } else {
+      fprintf(stderr,
+              "usage: %s [-n size[,size...]] [-w workload[,workload...]] "
+              "[-s seed]\nworkloads:",
+              argv[0]);
+      for (int w = 0; w < WL_COUNT; ++w)
+        fprintf(stderr, " %s", workload_names[w]);
+      fprintf(stderr, "\n");
+      return 2;
+    }
+  }
+
+  printf("tree,order,leaf_keys,workload,n,op,ops,ops_per_sec,p50_ns,p99_ns,"
+         "p999_ns,bytes_per_key,height\n");
+  for (size_t s = 0; s < nsizes; ++s) {
+    bench_run r = {.n = sizes[s]};
+    if (r.n == 0) continue;
+    r.entries     = malloc(r.n * sizeof(*r.entries));
+    r.search_keys = malloc(r.n * sizeof(*r.search_keys));
+    r.samples     = malloc(BENCH_MAX_SAMPLES * sizeof(*r.samples));
+    r.urls        = malloc(r.n * sizeof(*r.urls));
+    r.url_search  = malloc(r.n * sizeof(*r.url_search));
+    r.url_bytes   = malloc(r.n * BENCH_URL_BYTES);
+    if (!r.entries || !r.search_keys || !r.samples || !r.urls ||
+        !r.url_search || !r.url_bytes) {
+      fprintf(stderr, "out of memory for n=%zu\n", r.n);
+      return 1;
+    }
+    for (int w = 0; w < WL_COUNT; ++w) {
+      if (!enabled[w]) continue;
+      bench_rng_state = seed * 0x9E3779B97F4A7C15ULL + 1;
+      r.workload      = workload_names[w];
+      if (w == WL_PARALLEL) {
+        bench_make_keys(&r, WL_UNIFORM);
+        bench_parallel(&r);
+        fflush(stdout);
+        continue;
+      }
+      if (w == WL_STARTUP) {
+        bench_make_keys(&r, WL_UNIFORM);
+        bench_startup(&r);
+        fflush(stdout);
+        continue;
+      }
+      if (w == WL_CHURN) {
+        bench_churn_run(&r);
+        fflush(stdout);
+        continue;
+      }
+      if (w == WL_KERNELS) {
+        bench_kernels(&r);
+        fflush(stdout);
+        continue;
+      }
+      if (w == WL_URLS) {
+        bench_make_urls(&r);
+        for (size_t b = 0;
+             b < sizeof(bench_str_trees) / sizeof(bench_str_trees[0]); ++b)
+          bench_str_trees[b](&r);
+        fflush(stdout);
+        continue;
+      }
+      bench_make_keys(&r, (workload)w);
+      for (size_t b = 0; b < sizeof(bench_trees) / sizeof(bench_trees[0]);
+           ++b)
+        bench_trees[b](&r);
+      fflush(stdout);
+    }
+    free(r.entries);
+    free(r.search_keys);
+    free(r.samples);
+    free(r.urls);
+    free(r.url_search);
+    free(r.url_bytes);
+  }
+  return 0;
+}
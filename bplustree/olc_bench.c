@@ -0,0 +1,224 @@
+// Concurrent B+ tree benchmark.
+//
+// Runs a mix of searches, inserts and erases from several threads on
+// DEFINE_BTREE_OLC (olc.h) and, as the baseline, on intinttree with every
+// call behind one pthread mutex. Prints one CSV row per (tree, mix,
+// threads):
+//
+//   tree,mix,threads,n,ops,ops_per_sec
+//
+// Keys are drawn uniformly from 0..2n-1 and the tree starts with the n
+// even ones, so about half of the searches hit and the size stays near n.
+// Mixes, as search/insert/erase percentages:
+//   read  - 90/5/5
+//   write - 20/40/40
+// Every thread runs the same number of ops; ops_per_sec is all of them
+// over the time from the first thread starting to the last one finishing.
+// Both trees use nodes of about 256 bytes.
+//
+// usage: bplustree_olc_bench [-n size] [-t threads[,threads...]]
+//                            [-o ops_per_thread] [-s seed]
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "structures/bplustree/int_int_bplustree.h"
+#include "structures/bplustree/olc.h"
+
+#define BENCH_MAX_THREADS 64
+
+/* order 20: 256-byte internal nodes, like intinttree's */
+DEFINE_BTREE_OLC(bench_olc, IntIntBPlusTree, int, key, 20, CMP_INT)
+
+typedef struct {
+  const char *name;
+  int         search, insert; /* percent; the rest erase */
+} bench_mix;
+
+static const bench_mix bench_mixes[] = {{"read", 90, 5}, {"write", 20, 40}};
+
+typedef struct {
+  const bench_mix  *mix;
+  IntIntBPlusTree  *entries; /* key k at entries[k] */
+  size_t            keys;    /* 2n */
+  size_t            ops;     /* per thread */
+  pthread_barrier_t start;
+  bench_olc         olc;     /* a run uses olc or tree */
+  intinttree        tree;
+  pthread_mutex_t   lock;    /* guards tree */
+} bench_shared;
+
+typedef struct {
+  bench_shared *s;
+  uint64_t      rng;
+  uint64_t      t0, t1;
+  size_t        hits; /* keeps the searches from being optimized out */
+} bench_job;
+
+static uint64_t bench_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t bench_rand(uint64_t *state) {
+  /* xorshift64* */
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static void *bench_olc_worker(void *arg) {
+  bench_job       *job = arg;
+  bench_shared    *s   = job->s;
+  bench_olc_thread th;
+  if (bench_olc_attach(&s->olc, &th)) {
+    fprintf(stderr, "bench_olc_attach failed\n");
+    exit(1);
+  }
+  pthread_barrier_wait(&s->start);
+  job->t0 = bench_now_ns();
+  for (size_t i = 0; i < s->ops; ++i) {
+    uint64_t r   = bench_rand(&job->rng);
+    int      key = (int)((r >> 8) % s->keys);
+    int      op  = (int)(r % 100);
+    if (op < s->mix->search)
+      job->hits += bench_olc_search(&th, key) != NULL;
+    else if (op < s->mix->search + s->mix->insert)
+      bench_olc_insert_or_get(&th, &s->entries[key]);
+    else
+      bench_olc_erase(&th, key);
+  }
+  job->t1 = bench_now_ns();
+  bench_olc_detach(&th);
+  return NULL;
+}
+
+static void *bench_mutex_worker(void *arg) {
+  bench_job    *job = arg;
+  bench_shared *s   = job->s;
+  pthread_barrier_wait(&s->start);
+  job->t0 = bench_now_ns();
+  for (size_t i = 0; i < s->ops; ++i) {
+    uint64_t r   = bench_rand(&job->rng);
+    int      key = (int)((r >> 8) % s->keys);
+    int      op  = (int)(r % 100);
+    pthread_mutex_lock(&s->lock);
+    if (op < s->mix->search)
+      job->hits += intinttree_search(&s->tree, key) != NULL;
+    else if (op < s->mix->search + s->mix->insert)
+      intinttree_insert_or_get(&s->tree, &s->entries[key]);
+    else
+      intinttree_erase(&s->tree, key);
+    pthread_mutex_unlock(&s->lock);
+  }
+  job->t1 = bench_now_ns();
+  return NULL;
+}
+
+/* run fn on nthreads threads against s, print the row */
+static void bench_run(bench_shared *s, const char *tree, int nthreads,
+                      size_t n, uint64_t seed, void *(*fn)(void *)) {
+  pthread_t tid[BENCH_MAX_THREADS];
+  bench_job jobs[BENCH_MAX_THREADS];
+  pthread_barrier_init(&s->start, NULL, (unsigned)nthreads);
+  for (int i = 0; i < nthreads; ++i) {
+    jobs[i] = (bench_job){.s   = s,
+                          .rng = seed * 0x9E3779B97F4A7C15ULL + i + 1};
+    if (pthread_create(&tid[i], NULL, fn, &jobs[i])) {
+      fprintf(stderr, "pthread_create failed\n");
+      exit(1);
+    }
+  }
+  uint64_t t0 = UINT64_MAX, t1 = 0;
+  for (int i = 0; i < nthreads; ++i) {
+    pthread_join(tid[i], NULL);
+    if (jobs[i].t0 < t0) t0 = jobs[i].t0;
+    if (jobs[i].t1 > t1) t1 = jobs[i].t1;
+  }
+  pthread_barrier_destroy(&s->start);
+  size_t ops = s->ops * (size_t)nthreads;
+  printf("%s,%s,%d,%zu,%zu,%.0f\n", tree, s->mix->name, nthreads, n, ops,
+         (double)ops * 1e9 / (double)(t1 - t0));
+  fflush(stdout);
+}
+
+static size_t bench_parse_list(char *s, size_t *out, size_t cap) {
+  size_t count = 0;
+  for (char *tok = strtok(s, ","); tok && count < cap;
+       tok = strtok(NULL, ","))
+    out[count++] = strtoull(tok, NULL, 10);
+  return count;
+}
+
+int main(int argc, char **argv) {
+  size_t   n           = 1000000;
+  size_t   threads[16] = {1, 2, 4, 8};
+  size_t   nthreads    = 4;
+  size_t   ops         = 500000;
+  uint64_t seed        = 42;
+
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+      n = strtoull(argv[++i], NULL, 10);
+    } else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+      nthreads = bench_parse_list(argv[++i], threads, 16);
+    } else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+      ops = strtoull(argv[++i], NULL, 10);
+    } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+      seed = strtoull(argv[++i], NULL, 10);
+    } else {
+      fprintf(stderr,
+              "usage: %s [-n size] [-t threads[,threads...]] "
+              "[-o ops_per_thread] [-s seed]\n",
+              argv[0]);
+      return 2;
+    }
+  }
+  if (n == 0 || n > INT32_MAX / 2) {
+    fprintf(stderr, "size out of range\n");
+    return 2;
+  }
+
+  bench_shared s = {.keys = 2 * n, .ops = ops};
+  s.entries      = malloc(s.keys * sizeof(*s.entries));
+  if (!s.entries) {
+    fprintf(stderr, "out of memory for n=%zu\n", n);
+    return 1;
+  }
+  for (size_t k = 0; k < s.keys; ++k)
+    s.entries[k] = (IntIntBPlusTree){.key = (int)k, .value = (int)k};
+  pthread_mutex_init(&s.lock, NULL);
+
+  printf("tree,mix,threads,n,ops,ops_per_sec\n");
+  for (size_t m = 0; m < sizeof(bench_mixes) / sizeof(bench_mixes[0]); ++m) {
+    s.mix = &bench_mixes[m];
+    for (size_t t = 0; t < nthreads; ++t) {
+      int nt = (int)threads[t];
+      if (nt < 1 || nt > BENCH_MAX_THREADS) continue;
+
+      bench_olc_thread th;
+      bench_olc_init(&s.olc);
+      bench_olc_attach(&s.olc, &th);
+      for (size_t k = 0; k < s.keys; k += 2)
+        bench_olc_insert_or_get(&th, &s.entries[k]);
+      bench_olc_detach(&th);
+      bench_run(&s, "olc", nt, n, seed, bench_olc_worker);
+      bench_olc_destroy(&s.olc);
+
+      intinttree_init(&s.tree);
+      for (size_t k = 0; k < s.keys; k += 2)
+        intinttree_insert_or_get(&s.tree, &s.entries[k]);
+      bench_run(&s, "mutex", nt, n, seed, bench_mutex_worker);
+      intinttree_destroy(&s.tree);
+    }
+  }
+  pthread_mutex_destroy(&s.lock);
+  free(s.entries);
+  return 0;
+}
@@ -0,0 +1,328 @@
+// Hash map benchmark.
+//
+// Point lookups on intintmap against a B+ tree laid out like intinttree,
+// plus a copy of the map that rehashes all at once, to show what
+// incremental growing buys in tail latency. Prints one CSV row per (map,
+// workload, size, op):
+//
+//   map,workload,n,op,ops,ops_per_sec,p50_ns,p99_ns,p999_ns,max_ns,
+//   bytes_per_key
+//
+// Workloads are those of bplustree_bench with every key doubled:
+//   seq     - keys 0, 2, ..., 2n-2 in order; searches in the same order
+//   uniform - a random permutation of those; searches uniform over them
+//   zipf    - n draws from a Zipfian (theta 0.99) over n keys scattered
+//             across them; searches from the same distribution
+// Inserts go through name##_insert_or_get, starting from an empty map, so
+// they include every resize. "miss" looks up the odd key after each
+// search key, which is never there but lies among the keys that are.
+//
+// ops_per_sec comes from an untimed pass over every op. Latency
+// percentiles and the maximum come from a second pass that times every op
+// with clock_gettime, so they include the timer's own cost.
+// bytes_per_key counts table or node memory only, not the entries.
+//
+// usage: hashmap_bench [-n size[,size...]] [-w workload[,workload...]]
+//                      [-s seed]
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "structures/bplustree/int_int_bplustree.h"
+#include "structures/hashmap/int_int_hashmap.h"
+
+#define BENCH_MAX_SAMPLES (1 << 20)
+
+DEFINE_BTREE_SIZED_OPTS(bench_tree, IntIntHashMap, int, key, 256, CMP_INT,
+                        BTREE_OPT_INT_KEYS)
+
+/* the same map, moving the whole old table on the first write after it
+ * grows */
+#pragma push_macro("HASHMAP_MIGRATE_GROUPS")
+#undef HASHMAP_MIGRATE_GROUPS
+#define HASHMAP_MIGRATE_GROUPS SIZE_MAX
+DEFINE_HASHMAP(bench_rehashmap, IntIntHashMap, int, key, HASH_INT, EQ_INT)
+#pragma pop_macro("HASHMAP_MIGRATE_GROUPS")
+
+typedef enum { WL_SEQ, WL_UNIFORM, WL_ZIPF, WL_COUNT } workload;
+
+static const char *const workload_names[WL_COUNT] = {"seq", "uniform",
+                                                     "zipf"};
+
+typedef struct {
+  const char    *workload;
+  size_t         n;
+  IntIntHashMap *entries;     /* n entries, keys in insert order */
+  int           *search_keys; /* n keys to look up */
+  uint64_t      *samples;     /* per-op latencies, BENCH_MAX_SAMPLES */
+} bench_run;
+
+static uint64_t bench_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t bench_rng_state;
+
+static uint64_t bench_rand(void) {
+  /* xorshift64* */
+  bench_rng_state ^= bench_rng_state >> 12;
+  bench_rng_state ^= bench_rng_state << 25;
+  bench_rng_state ^= bench_rng_state >> 27;
+  return bench_rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static double bench_rand_unit(void) {
+  return (double)(bench_rand() >> 11) / (double)(1ULL << 53);
+}
+
+// Zipfian ranks in [0, n) with P(rank) ~ 1 / (rank+1)^theta, from Gray et
+// al., "Quickly Generating Billion-Record Synthetic Databases".
+typedef struct {
+  size_t n;
+  double theta, alpha, zetan, eta;
+} zipf_gen;
+
+static void zipf_init(zipf_gen *z, size_t n, double theta) {
+  double zeta2 = 0;
+  z->zetan     = 0;
+  for (size_t i = 1; i <= n; ++i) {
+    z->zetan += 1.0 / pow((double)i, theta);
+    if (i == 2) zeta2 = z->zetan;
+  }
+  z->n     = n;
+  z->theta = theta;
+  z->alpha = 1.0 / (1.0 - theta);
+  z->eta   = (1.0 - pow(2.0 / (double)n, 1.0 - theta)) /
+           (1.0 - zeta2 / z->zetan);
+}
+
+static size_t zipf_next(const zipf_gen *z) {
+  double u  = bench_rand_unit();
+  double uz = u * z->zetan;
+  if (uz < 1.0) return 0;
+  if (uz < 1.0 + pow(0.5, z->theta)) return z->n > 1 ? 1 : 0;
+  size_t r =
+      (size_t)((double)z->n * pow(z->eta * u - z->eta + 1.0, z->alpha));
+  return r < z->n ? r : z->n - 1;
+}
+
+/* spread hot ranks over the key space instead of clustering them at 0 */
+static int zipf_key(size_t rank, size_t n) {
+  uint64_t x = rank + 1;
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  return (int)(x % n);
+}
+
+static void bench_make_keys(bench_run *r, workload w) {
+  size_t   n = r->n;
+  zipf_gen z;
+  if (w == WL_ZIPF) zipf_init(&z, n, 0.99);
+  for (size_t i = 0; i < n; ++i) r->entries[i].key = (int)i;
+  if (w == WL_UNIFORM) {
+    for (size_t i = n - 1; i > 0; --i) {
+      size_t j          = bench_rand() % (i + 1);
+      int    k          = r->entries[i].key;
+      r->entries[i].key = r->entries[j].key;
+      r->entries[j].key = k;
+    }
+  }
+  for (size_t i = 0; i < n; ++i) {
+    r->entries[i].value = (int)i;
+    switch (w) {
+    case WL_SEQ:
+      r->search_keys[i] = (int)i;
+      break;
+    case WL_UNIFORM:
+      r->search_keys[i] = (int)(bench_rand() % n);
+      break;
+    default:
+      r->entries[i].key = zipf_key(zipf_next(&z), n);
+      r->search_keys[i] = zipf_key(zipf_next(&z), n);
+      break;
+    }
+    r->entries[i].key *= 2;
+    r->search_keys[i] *= 2;
+  }
+}
+
+static int bench_cmp_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static uint64_t bench_percentile(const uint64_t *sorted, size_t n, double p) {
+  if (n == 0) return 0;
+  size_t i = (size_t)(p * (double)(n - 1) + 0.5);
+  return sorted[i];
+}
+
+static void bench_report(const char *map, const bench_run *r, const char *op,
+                         size_t ops, uint64_t elapsed_ns, size_t nsamples,
+                         double bytes_per_key) {
+  qsort(r->samples, nsamples, sizeof(uint64_t), bench_cmp_u64);
+  printf("%s,%s,%zu,%s,%zu,%.0f,%llu,%llu,%llu,%llu,%.2f\n", map, r->workload,
+         r->n, op, ops,
+         elapsed_ns ? (double)ops * 1e9 / (double)elapsed_ns : 0.0,
+         (unsigned long long)bench_percentile(r->samples, nsamples, 0.50),
+         (unsigned long long)bench_percentile(r->samples, nsamples, 0.99),
+         (unsigned long long)bench_percentile(r->samples, nsamples, 0.999),
+         (unsigned long long)(nsamples ? r->samples[nsamples - 1] : 0),
+         bytes_per_key);
+}
+
+static size_t intintmap_bytes(const intintmap *m) {
+  size_t g = (m->cur.groups ? m->cur.mask + 1 : 0) +
+             (m->old.groups ? m->old.mask + 1 : 0);
+  return g * HASHMAP_GROUP_BYTES;
+}
+
+static size_t bench_rehashmap_bytes(const bench_rehashmap *m) {
+  size_t g = (m->cur.groups ? m->cur.mask + 1 : 0) +
+             (m->old.groups ? m->old.mask + 1 : 0);
+  return g * HASHMAP_GROUP_BYTES;
+}
+
+static size_t bench_tree_bytes(const bench_tree *t) {
+  btree_stats s;
+  bench_tree_stats(t, &s);
+  return s.node_bytes;
+}
+
+// Runner for one map or tree: name##_bench(run) fills it from run->entries
+// twice (once for throughput, once timing every insert), then measures
+// hits and misses on it.
+#define BENCH_MAP(name)                                                        \
+  static void name##_bench(bench_run *r) {                                     \
+    const char *mn      = #name;                                               \
+    size_t      n       = r->n;                                                \
+    size_t      stride  = n / BENCH_MAX_SAMPLES + 1;                           \
+    size_t      samples = 0;                                                   \
+    name        m;                                                             \
+                                                                               \
+    name##_init(&m);                                                           \
+    uint64_t t0 = bench_now_ns();                                              \
+    for (size_t i = 0; i < n; ++i) name##_insert_or_get(&m, &r->entries[i]);   \
+    uint64_t insert_ns = bench_now_ns() - t0;                                  \
+    name##_destroy(&m);                                                        \
+                                                                               \
+    name##_init(&m);                                                           \
+    for (size_t i = 0; i < n; ++i) {                                           \
+      if (i % stride) {                                                        \
+        name##_insert_or_get(&m, &r->entries[i]);                              \
+        continue;                                                              \
+      }                                                                        \
+      t0 = bench_now_ns();                                                     \
+      name##_insert_or_get(&m, &r->entries[i]);                                \
+      r->samples[samples++] = bench_now_ns() - t0;                             \
+    }                                                                          \
+    double bpk = (double)name##_bytes(&m) / (double)n;                         \
+    bench_report(mn, r, "insert", n, insert_ns, samples, bpk);                 \
+                                                                               \
+    /* found counts keep the loops from being optimised out */                 \
+    volatile size_t found = 0;                                                 \
+    t0                    = bench_now_ns();                                    \
+    for (size_t i = 0; i < n; ++i)                                             \
+      found += name##_search(&m, r->search_keys[i]) != NULL;                   \
+    uint64_t search_ns = bench_now_ns() - t0;                                  \
+    samples            = 0;                                                    \
+    for (size_t i = 0; i < n; i += stride) {                                   \
+      t0 = bench_now_ns();                                                     \
+      found += name##_search(&m, r->search_keys[i]) != NULL;                   \
+      r->samples[samples++] = bench_now_ns() - t0;                             \
+    }                                                                          \
+    bench_report(mn, r, "search", n, search_ns, samples, bpk);                 \
+                                                                               \
+    /* odd keys are never inserted */                                          \
+    t0 = bench_now_ns();                                                       \
+    for (size_t i = 0; i < n; ++i)                                             \
+      found += name##_search(&m, r->search_keys[i] + 1) != NULL;               \
+    uint64_t miss_ns = bench_now_ns() - t0;                                    \
+    samples          = 0;                                                      \
+    for (size_t i = 0; i < n; i += stride) {                                   \
+      t0 = bench_now_ns();                                                     \
+      found += name##_search(&m, r->search_keys[i] + 1) != NULL;               \
+      r->samples[samples++] = bench_now_ns() - t0;                             \
+    }                                                                          \
+    bench_report(mn, r, "miss", n, miss_ns, samples, bpk);                     \
+    name##_destroy(&m);                                                        \
+  }
+
+BENCH_MAP(intintmap)
+BENCH_MAP(bench_rehashmap)
+BENCH_MAP(bench_tree)
+
+static void (*const bench_maps[])(bench_run *) = {
+    intintmap_bench,
+    bench_rehashmap_bench,
+    bench_tree_bench,
+};
+
+/* parse "a,b,c" into sizes, returns the count */
+static size_t bench_parse_sizes(char *s, size_t *out, size_t cap) {
+  size_t count = 0;
+  for (char *tok = strtok(s, ","); tok && count < cap;
+       tok = strtok(NULL, ","))
+    out[count++] = strtoull(tok, NULL, 10);
+  return count;
+}
+
+int main(int argc, char **argv) {
+  size_t   sizes[16]         = {10000, 100000, 1000000};
+  size_t   nsizes            = 3;
+  bool     enabled[WL_COUNT] = {true, true, true};
+  uint64_t seed              = 42;
+
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+      nsizes = bench_parse_sizes(argv[++i], sizes, 16);
+    } else if (!strcmp(argv[i], "-w") && i + 1 < argc) {
+      memset(enabled, 0, sizeof(enabled));
+      for (char *tok = strtok(argv[++i], ","); tok; tok = strtok(NULL, ","))
+        for (int w = 0; w < WL_COUNT; ++w)
+          if (!strcmp(tok, workload_names[w])) enabled[w] = true;
+    } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+      seed = strtoull(argv[++i], NULL, 10);
+    } else {
+      fprintf(stderr,
+              "usage: %s [-n size[,size...]] [-w seq,uniform,zipf] "
+              "[-s seed]\n",
+              argv[0]);
+      return 2;
+    }
+  }
+
+  printf("map,workload,n,op,ops,ops_per_sec,p50_ns,p99_ns,p999_ns,max_ns,"
+         "bytes_per_key\n");
+  for (size_t s = 0; s < nsizes; ++s) {
+    bench_run r = {.n = sizes[s]};
+    if (r.n == 0) continue;
+    r.entries     = malloc(r.n * sizeof(*r.entries));
+    r.search_keys = malloc(r.n * sizeof(*r.search_keys));
+    r.samples     = malloc(BENCH_MAX_SAMPLES * sizeof(*r.samples));
+    if (!r.entries || !r.search_keys || !r.samples) {
+      fprintf(stderr, "out of memory for n=%zu\n", r.n);
+      return 1;
+    }
+    for (int w = 0; w < WL_COUNT; ++w) {
+      if (!enabled[w]) continue;
+      bench_rng_state = seed * 0x9E3779B97F4A7C15ULL + 1;
+      r.workload      = workload_names[w];
+      bench_make_keys(&r, (workload)w);
+      for (size_t b = 0; b < sizeof(bench_maps) / sizeof(bench_maps[0]); ++b)
+        bench_maps[b](&r);
+      fflush(stdout);
+    }
+    free(r.entries);
+    free(r.search_keys);
+    free(r.samples);
+  }
+  return 0;
+}
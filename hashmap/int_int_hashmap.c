@@ -0,0 +1,7 @@
+#include <stdio.h>
+
+#include "structures/hashmap/int_int_hashmap.h"
+
+void printIntIntHashMap(IntIntHashMap *o, void *_) {
+  printf("k=%d v=%d\n", o->key, o->value);
+}
@@ -4,5 +4,6 @@
 #define STRUCTURES_INTERN extern __attribute__((visibility("hidden")))
 
 #include "structures/bplustree/int_int_bplustree.h"
+#include "structures/hashmap/int_int_hashmap.h"
 
 unsigned int getrandom_uint(void);
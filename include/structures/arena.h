@@ -0,0 +1,116 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdlib.h>
+
+// Fixed-size slot allocator for tree nodes.
+//
+// Slots are carved out of cache-line aligned slabs with a bump pointer. Freed
+// slots go onto an intrusive free-list and are handed out again first.
+// Resetting or releasing the arena costs O(slabs), never O(slots).
+
+#define NODE_ARENA_ALIGN      64
+#define NODE_ARENA_SLAB_BYTES (64 * 1024)
+#define NODE_ARENA_MIN_SLOTS  16
+
+typedef struct node_arena_slab {
+  struct node_arena_slab *next;
+} node_arena_slab;
+
+typedef struct node_arena {
+  size_t           slot_size;  /* rounded up to NODE_ARENA_ALIGN */
+  size_t           slab_bytes; /* first NODE_ARENA_ALIGN bytes hold the link */
+  node_arena_slab *slabs;      /* slabs slots are being carved from */
+  node_arena_slab *spare;      /* slabs kept around by node_arena_reset() */
+  void            *free_list;  /* recycled slots, linked through 1st word */
+  char            *bump;
+  char            *bump_end;
+  size_t           nslabs; /* slabs owned, carved and spare */
+  size_t           live;   /* slots handed out and not yet freed */
+} node_arena;
+
+static inline size_t node_arena_round(size_t n) {
+  return (n + NODE_ARENA_ALIGN - 1) & ~(size_t)(NODE_ARENA_ALIGN - 1);
+}
+
+static inline void node_arena_init(node_arena *a, size_t slot_size) {
+  a->slot_size    = node_arena_round(slot_size);
+  size_t min_slab = NODE_ARENA_ALIGN + NODE_ARENA_MIN_SLOTS * a->slot_size;
+  a->slab_bytes =
+      min_slab > NODE_ARENA_SLAB_BYTES ? min_slab : NODE_ARENA_SLAB_BYTES;
+  a->slabs     = NULL;
+  a->spare     = NULL;
+  a->free_list = NULL;
+  a->bump      = NULL;
+  a->bump_end  = NULL;
+  a->nslabs    = 0;
+  a->live      = 0;
+}
+
+/* take a spare slab or allocate a new one and point the bump range at it */
+static inline int node_arena_grow(node_arena *a) {
+  node_arena_slab *s = a->spare;
+  if (s) {
+    a->spare = s->next;
+  } else {
+    s = aligned_alloc(NODE_ARENA_ALIGN, a->slab_bytes);
+    if (!s) return -1;
+    a->nslabs++;
+  }
+  s->next     = a->slabs;
+  a->slabs    = s;
+  a->bump     = (char *)s + NODE_ARENA_ALIGN;
+  a->bump_end = (char *)s + a->slab_bytes;
+  return 0;
+}
+
+static inline void *node_arena_alloc(node_arena *a) {
+  void *p = a->free_list;
+  if (p) {
+    a->free_list = *(void **)p;
+  } else {
+    if ((size_t)(a->bump_end - a->bump) < a->slot_size &&
+        node_arena_grow(a) != 0)
+      return NULL;
+    p = a->bump;
+    a->bump += a->slot_size;
+  }
+  a->live++;
+  return p;
+}
+
+static inline void node_arena_free(node_arena *a, void *p) {
+  *(void **)p  = a->free_list;
+  a->free_list = p;
+  a->live--;
+}
+
+/* drop every slot but keep the slabs for reuse */
+static inline void node_arena_reset(node_arena *a) {
+  while (a->slabs) {
+    node_arena_slab *s = a->slabs;
+    a->slabs           = s->next;
+    s->next            = a->spare;
+    a->spare           = s;
+  }
+  a->free_list = NULL;
+  a->bump      = NULL;
+  a->bump_end  = NULL;
+  a->live      = 0;
+}
+
+/* return every slab to the system */
+static inline void node_arena_release(node_arena *a) {
+  node_arena_reset(a);
+  while (a->spare) {
+    node_arena_slab *s = a->spare;
+    a->spare           = s->next;
+    free(s);
+  }
+  a->nslabs = 0;
+}
+
+/* bytes currently obtained from the system */
+static inline size_t node_arena_bytes(const node_arena *a) {
+  return a->nslabs * a->slab_bytes;
+}
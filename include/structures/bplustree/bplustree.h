@@ -6,240 +6,1306 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "structures/arena.h"
+#include "structures/bplustree/search.h"
 #include "structures/list.h"
 
+// Instantiation options for DEFINE_BTREE_OPTS, or-ed together.
+//
+// BTREE_OPT_ARENA    - nodes come from per-tree slab arenas (cache-line
+//                      aligned, recycled through a free-list) instead of
+//                      one malloc each
+// BTREE_OPT_INT_KEYS - key_type is a built-in integer and CMP orders it
+//                      numerically; node searches use the branchless/SIMD
+//                      kernels from search.h instead of calling CMP
+// BTREE_OPT_STATS    - hot paths update t->counters (see btree_counters);
+//                      without it the updates compile away
+// BTREE_OPT_COUNTS   - internal nodes keep the number of entries under each
+//                      child, one size_t per child, so name##_rank,
+//                      name##_select and name##_count_range take O(log n)
+//                      instead of a walk over the leaves
+#define BTREE_OPT_NONE     0u
+#define BTREE_OPT_ARENA    (1u << 0)
+#define BTREE_OPT_INT_KEYS (1u << 1)
+#define BTREE_OPT_STATS    (1u << 2)
+#define BTREE_OPT_COUNTS   (1u << 3)
+
+// Deepest root-to-leaf path insert keeps on its stack.
+#define BTREE_MAX_DEPTH 64
+
+// Event counts kept in every tree and updated only with BTREE_OPT_STATS.
+// Zero them with memset to start a new measurement.
+typedef struct btree_counters {
+  unsigned long long searches;       /* name##_search calls */
+  unsigned long long inserts;        /* insert, insert_or_get and upsert */
+  unsigned long long descents;       /* root-to-leaf walks */
+  unsigned long long appends;        /* inserts that skipped the descent */
+  unsigned long long inner_visits;   /* internal nodes searched on descents */
+  unsigned long long comparisons;    /* keys compared, see name##_ncmp */
+  unsigned long long leaf_splits;
+  unsigned long long inner_splits;
+  unsigned long long iterate_leaves; /* leaves walked by name##_iterate */
+} btree_counters;
+
+// add n to counter field of tree t if OPTS has BTREE_OPT_STATS
+#define BTREE_COUNT_(OPTS, t, field, n)                                        \
+  do {                                                                         \
+    if ((OPTS) & BTREE_OPT_STATS) (t)->counters.field += (n);                  \
+  } while (0)
+
+// Shape of a tree as reported by name##_stats. Fill histograms bucket
+// nodes by nkeys / capacity in tenths: bucket i holds fills in
+// [i/10, (i+1)/10) and full nodes land in the last bucket.
+#define BTREE_FILL_BUCKETS 10
+
+typedef struct btree_stats {
+  int            height;     /* levels, 0 for an empty tree */
+  size_t         entries;
+  size_t         leaves;
+  size_t         inners;
+  size_t         node_bytes; /* leaves and internal nodes, not entries */
+  double         leaf_fill;  /* average entries / leaf capacity */
+  double         inner_fill; /* average children / ORDER */
+  size_t         leaf_hist[BTREE_FILL_BUCKETS];
+  size_t         inner_hist[BTREE_FILL_BUCKETS];
+  size_t         chain_length; /* leaves on the leaf list */
+  btree_counters counters;     /* copy of t->counters */
+} btree_stats;
+
+static inline int btree_fill_bucket(int used, int cap) {
+  int b = used * BTREE_FILL_BUCKETS / cap;
+  return b < BTREE_FILL_BUCKETS ? b : BTREE_FILL_BUCKETS - 1;
+}
+
+// name##_search_batch: lookups that descend together, and how many leading
+// bytes of each node they prefetch one level ahead.
+#define BTREE_BATCH_GROUP    16
+#define BTREE_PREFETCH_BYTES 256
+
+// Node sizing for DEFINE_BTREE_SIZED. Both node kinds start with a header
+// laid out as btree_node_hdr_, padding included. An internal node is the
+// header, ORDER-1 keys and ORDER child pointers, plus ORDER counts with
+// BTREE_OPT_COUNTS; a leaf is the header, LEAF_KEYS keys, LEAF_KEYS entry
+// pointers and a list_head. The *_FOR_BYTES macros pick the largest count
+// whose node still fits in the given number of bytes.
+typedef struct btree_node_hdr_ {
+  bool is_leaf;
+  int  nkeys;
+} btree_node_hdr_;
+
+#define BTREE_ALIGN_UP_(x, a) (((x) + (a) - 1) / (a) * (a))
+#define BTREE_MAX_(a, b)      ((a) > (b) ? (a) : (b))
+#define BTREE_HDR_BYTES_(key_type)                                             \
+  BTREE_ALIGN_UP_(sizeof(btree_node_hdr_), _Alignof(key_type))
+#define BTREE_NODE_ALIGN_(key_type)                                            \
+  BTREE_MAX_(_Alignof(key_type), _Alignof(void *))
+#define BTREE_CHILD_BYTES_(OPTS)                                               \
+  (sizeof(void *) + ((OPTS) & BTREE_OPT_COUNTS ? sizeof(size_t) : 0))
+#define BTREE_INNER_BYTES(order, key_type)                                     \
+  BTREE_ALIGN_UP_(BTREE_ALIGN_UP_(BTREE_HDR_BYTES_(key_type) +                 \
+                                      ((order) - 1) * sizeof(key_type),        \
+                                  _Alignof(void *)) +                          \
+                      (order) * sizeof(void *),                                \
+                  BTREE_NODE_ALIGN_(key_type))
+#define BTREE_INNER_BYTES_OPTS(order, key_type, OPTS)                          \
+  BTREE_ALIGN_UP_(BTREE_INNER_BYTES(order, key_type) +                         \
+                      ((OPTS) & BTREE_OPT_COUNTS ? (order) * sizeof(size_t)    \
+                                                 : 0),                         \
+                  BTREE_NODE_ALIGN_(key_type))
+#define BTREE_LEAF_BYTES(nkeys, key_type)                                      \
+  BTREE_ALIGN_UP_(BTREE_ALIGN_UP_(BTREE_HDR_BYTES_(key_type) +                 \
+                                      (nkeys) * sizeof(key_type),              \
+                                  _Alignof(void *)) +                          \
+                      (nkeys) * sizeof(void *) + sizeof(list_head),            \
+                  BTREE_NODE_ALIGN_(key_type))
+#define BTREE_ORDER_GUESS_(bytes, key_type, OPTS)                              \
+  (((bytes) - BTREE_HDR_BYTES_(key_type) + sizeof(key_type)) /                 \
+   (sizeof(key_type) + BTREE_CHILD_BYTES_(OPTS)))
+#define BTREE_ORDER_FOR_BYTES(bytes, key_type)                                 \
+  BTREE_ORDER_FOR_BYTES_OPTS(bytes, key_type, BTREE_OPT_NONE)
+#define BTREE_ORDER_FOR_BYTES_OPTS(bytes, key_type, OPTS)                      \
+  (BTREE_INNER_BYTES_OPTS(BTREE_ORDER_GUESS_(bytes, key_type, OPTS),           \
+                          key_type, OPTS) <= (bytes)                           \
+       ? BTREE_ORDER_GUESS_(bytes, key_type, OPTS)                             \
+       : BTREE_ORDER_GUESS_(bytes, key_type, OPTS) - 1)
+#define BTREE_LEAF_GUESS_(bytes, key_type)                                     \
+  (((bytes) - BTREE_HDR_BYTES_(key_type) - sizeof(list_head)) /                \
+   (sizeof(key_type) + sizeof(void *)))
+#define BTREE_LEAF_KEYS_FOR_BYTES(bytes, key_type)                             \
+  (BTREE_LEAF_BYTES(BTREE_LEAF_GUESS_(bytes, key_type), key_type) <= (bytes)   \
+       ? BTREE_LEAF_GUESS_(bytes, key_type)                                    \
+       : BTREE_LEAF_GUESS_(bytes, key_type) - 1)
+
+// Loop over the entries of tree t (of type name) with lo <= key < hi in key
+// order. cur is a name##_cursor; name##_cursor_entry(&cur) is the current
+// entry. break and continue work as in any for loop, so the scan stops as
+// early as the body wants and costs O(height + entries visited).
+#define BTREE_RANGE_FOREACH(name, t, lo, hi, cur)                              \
+  for (name##_cursor cur = name##_lower_bound((t), (lo));                      \
+       name##_cursor_before(&cur, (hi)); name##_cursor_next(&cur))
+
 // Macro to define a typed B+ tree.
 //
-// name                   - prefix for generated types/functions
-// entry_type             - user struct type that contains the key (intrusive
-// entry) key_type               - type of key (e.g. int, long, etc.) key_member
-// - member name inside entry_type that is the key ORDER                  - max
-// number of children for internal nodes (>=3). leaf capacity = ORDER-1 CMP(a,b)
-// - macro/function comparing two keys: returns <0 if a<b, 0 if equal, >0 if a>b
+// name       - prefix for generated types/functions
+// entry_type - user struct type that contains the key (intrusive entry)
+// key_type   - type of key (e.g. int, long, etc.)
+// key_member - member name inside entry_type that is the key
+// ORDER      - max number of children for internal nodes (>=3).
+//              leaf capacity = ORDER-1
+// CMP(a,b)   - macro/function comparing two keys: returns <0 if a<b, 0 if
+//              equal, >0 if a>b
 //
+// Snapshots (snapshot.h) and the multi-threaded scan and bulk load
+// (parallel.h) are opt-in per tree: DEFINE_BTREE_SNAPSHOT(name) and
+// DEFINE_BTREE_PARALLEL(name) after the tree's DEFINE_BTREE* add them.
 #define DEFINE_BTREE(name, entry_type, key_type, key_member, ORDER, CMP)       \
+  DEFINE_BTREE_OPTS(name, entry_type, key_type, key_member, ORDER, CMP,        \
+                    BTREE_OPT_NONE)
+
+// Same as DEFINE_BTREE with BTREE_OPT_* flags in OPTS.
+#define DEFINE_BTREE_OPTS(name, entry_type, key_type, key_member, ORDER, CMP,  \
+                          OPTS)                                                \
+  DEFINE_BTREE_LAYOUT(name, entry_type, key_type, key_member, ORDER,           \
+                      (ORDER) - 1, CMP, OPTS)
+
+// B+ tree whose internal nodes and leaves each fit in NODE_BYTES (e.g. 256
+// or 4096), with ORDER and leaf capacity derived from sizeof(key_type).
+#define DEFINE_BTREE_SIZED(name, entry_type, key_type, key_member, NODE_BYTES, \
+                           CMP)                                                \
+  DEFINE_BTREE_SIZED_OPTS(name, entry_type, key_type, key_member, NODE_BYTES,  \
+                          CMP, BTREE_OPT_NONE)
+
+#define DEFINE_BTREE_SIZED_OPTS(name, entry_type, key_type, key_member,        \
+                                NODE_BYTES, CMP, OPTS)                         \
+  DEFINE_BTREE_LAYOUT(name, entry_type, key_type, key_member,                  \
+                      BTREE_ORDER_FOR_BYTES_OPTS(NODE_BYTES, key_type, OPTS),  \
+                      BTREE_LEAF_KEYS_FOR_BYTES(NODE_BYTES, key_type), CMP,    \
+                      OPTS)                                                    \
+  _Static_assert(name##_INNER_BYTES <= (NODE_BYTES) &&                         \
+                     sizeof(name##_leaf) <= (NODE_BYTES),                      \
+                 #name ": nodes do not fit in " #NODE_BYTES " bytes");
+
+// Common generator: ORDER children per internal node, LEAF_KEYS entries per
+// leaf.
+#define DEFINE_BTREE_LAYOUT(name, entry_type, key_type, key_member, ORDER,     \
+                            LEAF_KEYS, CMP, OPTS)                              \
                                                                                \
-  enum { name##_ORDER = (ORDER), name##_MAX_KEYS = (ORDER) - 1 };              \
+  enum {                                                                       \
+    name##_ORDER     = (ORDER),                                                \
+    name##_MAX_KEYS  = (ORDER) - 1,                                            \
+    name##_LEAF_KEYS = (LEAF_KEYS),                                            \
+    name##_OPTS      = (OPTS)                                                  \
+  };                                                                           \
+  _Static_assert((ORDER) >= 3 && (LEAF_KEYS) >= 2,                             \
+                 #name ": ORDER must be >= 3 and LEAF_KEYS >= 2");             \
+  _Static_assert(!((OPTS) & BTREE_OPT_INT_KEYS) ||                             \
+                     BTREE_SEARCH_HAS_KERNEL(key_type),                        \
+                 #name ": BTREE_OPT_INT_KEYS needs an integer key_type");      \
                                                                                \
-  typedef struct name##_node name##_node;                                      \
-  /* internal node */                                                          \
+  /* header shared by both node layouts; cast to name##_inner or               \
+   * name##_leaf according to is_leaf */                                       \
   typedef struct name##_node {                                                 \
-    bool         is_leaf;                                                      \
-    int          nkeys;                                                        \
-    key_type     keys[name##_MAX_KEYS]; /* separators */                       \
-    name##_node *children[(ORDER)];     /* children count = nkeys+1 */         \
-    /* leaf-specific */                                                        \
-    entry_type *leaf_entries[name##_MAX_KEYS];                                 \
-    list_head   leaf_link; /* link into leaf-level doubly-linked list */       \
+    bool is_leaf;                                                              \
+    int  nkeys;                                                                \
   } name##_node;                                                               \
+  _Static_assert(sizeof(name##_node) == sizeof(btree_node_hdr_),               \
+                 #name ": node header must match btree_node_hdr_");            \
+                                                                               \
+  /* internal node */                                                          \
+  typedef struct name##_inner {                                                \
+    name##_node  hdr;                                                          \
+    key_type     keys[name##_MAX_KEYS];  /* separators */                      \
+    name##_node *children[name##_ORDER]; /* children count = nkeys+1 */        \
+  } name##_inner;                                                              \
+                                                                               \
+  /* internal node with BTREE_OPT_COUNTS: the entries under each child         \
+   * follow the children. Without the option only the name##_inner part        \
+   * is allocated, so name##_INNER_BYTES is the size of an internal node */    \
+  typedef struct name##_counted {                                              \
+    name##_inner in;                                                           \
+    size_t       counts[name##_ORDER];                                         \
+  } name##_counted;                                                            \
+                                                                               \
+  enum {                                                                       \
+    name##_INNER_BYTES = (OPTS) & BTREE_OPT_COUNTS ? sizeof(name##_counted)    \
+                                                   : sizeof(name##_inner)      \
+  };                                                                           \
+                                                                               \
+  /* leaf: leaf_entries[i]->key_member == keys[i], so searches and shifts      \
+   * stay inside the node */                                                   \
+  typedef struct name##_leaf {                                                 \
+    name##_node hdr;                                                           \
+    key_type    keys[name##_LEAF_KEYS];                                        \
+    entry_type *leaf_entries[name##_LEAF_KEYS];                                \
+    list_head   leaf_link; /* link into leaf-level doubly-linked list */       \
+  } name##_leaf;                                                               \
                                                                                \
   typedef struct name name;                                                    \
   typedef struct name {                                                        \
-    name##_node *root;                                                         \
-    list_head    leaves; /* head of leaf list */                               \
+    name##_node   *root;                                                       \
+    list_head      leaves;      /* head of leaf list */                        \
+    node_arena     inner_arena; /* node storage with BTREE_OPT_ARENA */        \
+    node_arena     leaf_arena;                                                 \
+    int            leaf_min; /* see name##_set_merge_thresholds */             \
+    int            inner_min;                                                  \
+    btree_counters counters; /* updated with BTREE_OPT_STATS */                \
   } name;                                                                      \
                                                                                \
-  /* allocate node */                                                          \
-  static inline name##_node *name##_node_alloc(void) {                         \
-    name##_node *n = malloc(sizeof(*n));                                       \
+  static inline name##_inner *name##_as_inner(name##_node *n) {                \
+    return (name##_inner *)n;                                                  \
+  }                                                                            \
+                                                                               \
+  static inline name##_leaf *name##_as_leaf(name##_node *n) {                  \
+    return (name##_leaf *)n;                                                   \
+  }                                                                            \
+                                                                               \
+  /* the child counts of n; only with BTREE_OPT_COUNTS */                      \
+  static inline size_t *name##_counts(name##_inner *n) {                       \
+    return ((name##_counted *)n)->counts;                                      \
+  }                                                                            \
+                                                                               \
+  /* the instantiation's types, CMP and key_member for code generated          \
+   * from the name alone (DEFINE_BTREE_SNAPSHOT, DEFINE_BTREE_PARALLEL) */     \
+  typedef key_type   name##_key_t;                                             \
+  typedef entry_type name##_entry_t;                                           \
+                                                                               \
+  static inline int name##_cmp(key_type a, key_type b) { return CMP(a, b); }   \
+                                                                               \
+  static inline key_type name##_key_of(const entry_type *e) {                  \
+    return e->key_member;                                                      \
+  }                                                                            \
+                                                                               \
+  /* entries under n, from the counts of its children */                       \
+  static inline size_t name##_subtree_size(name##_node *n) {                   \
+    if (n->is_leaf || !(name##_OPTS & BTREE_OPT_COUNTS))                       \
+      return (size_t)n->nkeys;                                                 \
+    size_t size = 0;                                                           \
+    for (int i = 0; i <= n->nkeys; ++i)                                        \
+      size += name##_counts(name##_as_inner(n))[i];                            \
+    return size;                                                               \
+  }                                                                            \
+                                                                               \
+  /* add delta to the count of every child on a path recorded by               \
+   * name##_descend, after an entry went into or out of its leaf */            \
+  static inline void name##_count_path(name##_inner **path, int *idx,          \
+                                       int depth, int delta) {                 \
+    if (name##_OPTS & BTREE_OPT_COUNTS)                                        \
+      for (int d = 0; d < depth; ++d) name##_counts(path[d])[idx[d]] += delta; \
+  }                                                                            \
+                                                                               \
+  /* allocate nodes */                                                         \
+  static inline name##_leaf *name##_leaf_alloc(name *t) {                      \
+    name##_leaf *n = (name##_OPTS & BTREE_OPT_ARENA)                           \
+                         ? node_arena_alloc(&t->leaf_arena)                    \
+                         : malloc(sizeof(*n));                                 \
     if (!n) return NULL;                                                       \
-    n->is_leaf = true;                                                         \
-    n->nkeys   = 0;                                                            \
+    n->hdr.is_leaf = true;                                                     \
+    n->hdr.nkeys   = 0;                                                        \
     INIT_LIST_HEAD(&n->leaf_link);                                             \
-    memset(n->children, 0, sizeof(n->children));                               \
-    memset(n->leaf_entries, 0, sizeof(n->leaf_entries));                       \
     return n;                                                                  \
   }                                                                            \
                                                                                \
+  static inline name##_inner *name##_inner_alloc(name *t) {                    \
+    name##_inner *n = (name##_OPTS & BTREE_OPT_ARENA)                          \
+                          ? node_arena_alloc(&t->inner_arena)                  \
+                          : malloc(name##_INNER_BYTES);                        \
+    if (!n) return NULL;                                                       \
+    n->hdr.is_leaf = false;                                                    \
+    n->hdr.nkeys   = 0;                                                        \
+    return n;                                                                  \
+  }                                                                            \
+                                                                               \
+  static inline void name##_node_free(name *t, name##_node *n) {               \
+    if (!(name##_OPTS & BTREE_OPT_ARENA))                                      \
+      free(n);                                                                 \
+    else if (n->is_leaf)                                                       \
+      node_arena_free(&t->leaf_arena, n);                                      \
+    else                                                                       \
+      node_arena_free(&t->inner_arena, n);                                     \
+  }                                                                            \
+                                                                               \
   static inline void name##_init(name *t) {                                    \
     t->root = NULL;                                                            \
     INIT_LIST_HEAD(&t->leaves);                                                \
+    node_arena_init(&t->inner_arena, name##_INNER_BYTES);                      \
+    node_arena_init(&t->leaf_arena, sizeof(name##_leaf));                      \
+    t->leaf_min  = name##_LEAF_KEYS / 4;                                       \
+    t->inner_min = name##_MAX_KEYS / 4;                                        \
+    memset(&t->counters, 0, sizeof(t->counters));                              \
+  }                                                                            \
+                                                                               \
+  /* free a subtree node by node */                                            \
+  static inline void name##_free_subtree(name *t, name##_node *n) {            \
+    if (!n->is_leaf)                                                           \
+      for (int i = 0; i <= n->nkeys; ++i)                                      \
+        name##_free_subtree(t, name##_as_inner(n)->children[i]);               \
+    name##_node_free(t, n);                                                    \
+  }                                                                            \
+                                                                               \
+  /* drop every node; entries are owned by the caller and left alone.          \
+   * the arenas keep their slabs, so refilling the tree does not hit malloc */ \
+  static inline void name##_clear(name *t) {                                   \
+    if (name##_OPTS & BTREE_OPT_ARENA) {                                       \
+      node_arena_reset(&t->inner_arena);                                       \
+      node_arena_reset(&t->leaf_arena);                                        \
+    } else if (t->root) {                                                      \
+      name##_free_subtree(t, t->root);                                         \
+    }                                                                          \
+    t->root = NULL;                                                            \
+    INIT_LIST_HEAD(&t->leaves);                                                \
+  }                                                                            \
+                                                                               \
+  /* clear the tree and give all node memory back to the system */             \
+  static inline void name##_destroy(name *t) {                                 \
+    name##_clear(t);                                                           \
+    node_arena_release(&t->inner_arena);                                       \
+    node_arena_release(&t->leaf_arena);                                        \
   }                                                                            \
                                                                                \
-  /* find leaf node for key (return node and index where key <= separator) */  \
-  static inline name##_node *name##_find_leaf(name *t, key_type key) {         \
+  /* nodes shorter than BTREE_SEARCH_MIN_KEYS are faster with the              \
+   * early-exit loop */                                                        \
+  enum {                                                                       \
+    name##_USE_KERNEL = ((OPTS) & BTREE_OPT_INT_KEYS) &&                       \
+                        name##_MAX_KEYS >= BTREE_SEARCH_MIN_KEYS               \
+  };                                                                           \
+                                                                               \
+  /* number of keys[0..n) <= key: child to follow in an internal node,         \
+   * insert position after equal keys in a leaf */                             \
+  static inline int name##_count_le(const key_type *keys, int n,               \
+                                    key_type key) {                            \
+    if (name##_USE_KERNEL)                                                     \
+      return BTREE_SEARCH_KERNEL(key, le)(keys, n, &key);                      \
+    int i = 0;                                                                 \
+    while (i < n && CMP(key, keys[i]) >= 0) i++;                               \
+    return i;                                                                  \
+  }                                                                            \
+                                                                               \
+  /* number of keys[0..n) < key: first slot that can hold key */               \
+  static inline int name##_count_lt(const key_type *keys, int n,               \
+                                    key_type key) {                            \
+    if (name##_USE_KERNEL)                                                     \
+      return BTREE_SEARCH_KERNEL(key, lt)(keys, n, &key);                      \
+    int i = 0;                                                                 \
+    while (i < n && CMP(keys[i], key) < 0) i++;                                \
+    return i;                                                                  \
+  }                                                                            \
+                                                                               \
+  /* child index to follow for key: go right while key >= keys[i] */           \
+  static inline int name##_inner_slot(const name##_inner *n, key_type key) {   \
+    return name##_count_le(n->keys, n->hdr.nkeys, key);                        \
+  }                                                                            \
+                                                                               \
+  /* keys compared by a count_le/count_lt that returned slot out of n: the     \
+   * CMP loop stops at the first key past key, the kernels read all n */       \
+  static inline int name##_ncmp(int n, int slot) {                             \
+    return name##_USE_KERNEL || slot == n ? n : slot + 1;                      \
+  }                                                                            \
+                                                                               \
+  /* find leaf node for key */                                                 \
+  static inline name##_leaf *name##_find_leaf(name *t, key_type key) {         \
     name##_node *n = t->root;                                                  \
     if (!n) return NULL;                                                       \
+    BTREE_COUNT_(name##_OPTS, t, descents, 1);                                 \
     while (!n->is_leaf) {                                                      \
-      int i = 0;                                                               \
-      while (i < n->nkeys && CMP(key, n->keys[i]) >= 0)                        \
-        i++; /* go right while key >= key[i] */                                \
-      n = n->children[i];                                                      \
+      name##_inner *in   = name##_as_inner(n);                                 \
+      int           slot = name##_inner_slot(in, key);                         \
+      BTREE_COUNT_(name##_OPTS, t, inner_visits, 1);                           \
+      BTREE_COUNT_(name##_OPTS, t, comparisons,                                \
+                   name##_ncmp(in->hdr.nkeys, slot));                          \
+      n = in->children[slot];                                                  \
     }                                                                          \
-    return n;                                                                  \
+    return name##_as_leaf(n);                                                  \
+  }                                                                            \
+                                                                               \
+  /* entry with key in leaf, or NULL */                                        \
+  static inline entry_type *name##_leaf_get(const name##_leaf *leaf,           \
+                                            key_type key) {                    \
+    int i = name##_count_lt(leaf->keys, leaf->hdr.nkeys, key);                 \
+    if (i < leaf->hdr.nkeys && CMP(leaf->keys[i], key) == 0)                   \
+      return leaf->leaf_entries[i];                                            \
+    return NULL;                                                               \
   }                                                                            \
                                                                                \
   /* search for key -> return entry_type* or NULL */                           \
   static inline entry_type *name##_search(name *t, key_type key) {             \
-    name##_node *leaf = name##_find_leaf(t, key);                              \
+    BTREE_COUNT_(name##_OPTS, t, searches, 1);                                 \
+    name##_leaf *leaf = name##_find_leaf(t, key);                              \
     if (!leaf) return NULL;                                                    \
-    for (int i = 0; i < leaf->nkeys; ++i) {                                    \
-      if (CMP(key, leaf->leaf_entries[i]->key_member) == 0)                    \
-        return leaf->leaf_entries[i];                                          \
-    }                                                                          \
+    int n = leaf->hdr.nkeys;                                                   \
+    int i = name##_count_lt(leaf->keys, n, key);                               \
+    BTREE_COUNT_(name##_OPTS, t, comparisons, name##_ncmp(n, i));              \
+    if (i < n && CMP(leaf->keys[i], key) == 0) return leaf->leaf_entries[i];   \
     return NULL;                                                               \
   }                                                                            \
                                                                                \
-  /* helper: insert into leaf assumed not full */                              \
-  static inline void name##_leaf_insert_nofull(name##_node *leaf,              \
-                                               entry_type  *e) {                \
-    key_type k = e->key_member;                                                \
-    int      i = leaf->nkeys - 1;                                              \
-    /* shift right until place found */                                        \
-    while (i >= 0 && CMP(leaf->leaf_entries[i]->key_member, k) > 0) {          \
-      leaf->leaf_entries[i + 1] = leaf->leaf_entries[i];                       \
-      i--;                                                                     \
+  /* pull the first BTREE_PREFETCH_BYTES of a node towards the cache */        \
+  static inline void name##_prefetch(const name##_node *n) {                   \
+    const char  *p = (const char *)n;                                          \
+    const size_t bytes =                                                       \
+        BTREE_MAX_((size_t)name##_INNER_BYTES, sizeof(name##_leaf));           \
+    for (size_t off = 0; off < bytes && off < BTREE_PREFETCH_BYTES; off += 64) \
+      __builtin_prefetch(p + off);                                             \
+  }                                                                            \
+                                                                               \
+  /* out[i] = name##_search(t, keys[i]) for i in [0, n). Lookups run in        \
+   * groups of BTREE_BATCH_GROUP that go down the tree together, one level     \
+   * per pass: every lookup picks its child and prefetches it, and the         \
+   * child is only read on the next pass, so the group's cache misses          \
+   * overlap instead of following each other. */                               \
+  static inline void name##_search_batch(name *t, const key_type *keys,        \
+                                         size_t n, entry_type **out) {         \
+    name##_node *node[BTREE_BATCH_GROUP];                                      \
+    if (!t->root) {                                                            \
+      for (size_t i = 0; i < n; ++i) out[i] = NULL;                            \
+      return;                                                                  \
+    }                                                                          \
+    for (size_t base = 0; base < n; base += BTREE_BATCH_GROUP) {               \
+      size_t g = n - base < BTREE_BATCH_GROUP ? n - base : BTREE_BATCH_GROUP;  \
+      for (size_t j = 0; j < g; ++j) node[j] = t->root;                        \
+      /* all leaves are at the same depth */                                   \
+      while (!node[0]->is_leaf) {                                              \
+        for (size_t j = 0; j < g; ++j) {                                       \
+          name##_inner *in = name##_as_inner(node[j]);                         \
+          node[j] = in->children[name##_inner_slot(in, keys[base + j])];       \
+          name##_prefetch(node[j]);                                            \
+        }                                                                      \
+      }                                                                        \
+      for (size_t j = 0; j < g; ++j)                                           \
+        out[base + j] =                                                        \
+            name##_leaf_get(name##_as_leaf(node[j]), keys[base + j]);          \
     }                                                                          \
-    leaf->leaf_entries[i + 1] = e;                                             \
-    leaf->nkeys++;                                                             \
   }                                                                            \
                                                                                \
-  /* split leaf: leaf is full, create new_leaf and move half entries */        \
-  static inline name##_node *name##_split_leaf(name##_node *leaf) {            \
-    int mid = (name##_MAX_KEYS + 1) /                                          \
-              2; /* ceil half stays in left? we'll move right half */          \
-    name##_node *right = name##_node_alloc();                                  \
+  /* name##_search_batch for keys sorted ascending, best when they are         \
+   * clustered. Consecutive keys share the top of their paths: the walk        \
+   * keeps the root-to-leaf path with the separator bounding each node on      \
+   * the right and only climbs as far as the first node whose range the        \
+   * next key leaves. Keys in the same leaf cost one leaf search each. */      \
+  static inline void name##_search_sorted_batch(name *t, const key_type *keys, \
+                                                size_t n, entry_type **out) {  \
+    name##_node *path[BTREE_MAX_DEPTH];                                        \
+    key_type     bound[BTREE_MAX_DEPTH]; /* keys in path[d] are < bound[d] */  \
+    bool         bounded[BTREE_MAX_DEPTH];                                     \
+    int          depth = 0;                                                    \
+    if (!t->root) {                                                            \
+      for (size_t i = 0; i < n; ++i) out[i] = NULL;                            \
+      return;                                                                  \
+    }                                                                          \
+    path[0]    = t->root;                                                      \
+    bounded[0] = false;                                                        \
+    for (size_t i = 0; i < n; ++i) {                                           \
+      key_type key = keys[i];                                                  \
+      while (depth > 0 && bounded[depth] && CMP(key, bound[depth]) >= 0)       \
+        depth--;                                                               \
+      while (!path[depth]->is_leaf) {                                          \
+        name##_inner *in   = name##_as_inner(path[depth]);                     \
+        int           slot = name##_inner_slot(in, key);                       \
+        path[depth + 1]    = in->children[slot];                               \
+        if (slot < in->hdr.nkeys) {                                            \
+          bound[depth + 1]   = in->keys[slot];                                 \
+          bounded[depth + 1] = true;                                           \
+        } else {                                                               \
+          /* rightmost child: same right bound as the parent */                \
+          bounded[depth + 1] = bounded[depth];                                 \
+          if (bounded[depth]) bound[depth + 1] = bound[depth];                 \
+        }                                                                      \
+        depth++;                                                               \
+      }                                                                        \
+      out[i] = name##_leaf_get(name##_as_leaf(path[depth]), key);              \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  /* helper: put e at slot i of a leaf that is not full */                     \
+  static inline void name##_leaf_insert_at(name##_leaf *leaf, int i,           \
+                                           entry_type *e) {                    \
+    key_type k = e->key_member;                                                \
+    int      n = leaf->hdr.nkeys;                                              \
+    /* shift the tail right by one */                                          \
+    memmove(&leaf->keys[i + 1], &leaf->keys[i], (n - i) * sizeof(key_type));   \
+    memmove(&leaf->leaf_entries[i + 1], &leaf->leaf_entries[i],                \
+            (n - i) * sizeof(entry_type *));                                   \
+    leaf->keys[i]         = k;                                                 \
+    leaf->leaf_entries[i] = e;                                                 \
+    leaf->hdr.nkeys++;                                                         \
+  }                                                                            \
+                                                                               \
+  /* split leaf: create a new leaf to its right and move entries [mid, n)      \
+   * there */                                                                  \
+  static inline name##_leaf *name##_split_leaf(name *t, name##_leaf *leaf,     \
+                                               int mid) {                      \
+    name##_leaf *right = name##_leaf_alloc(t);                                 \
     if (!right) return NULL;                                                   \
-    right->is_leaf = true;                                                     \
-    right->nkeys   = 0;                                                        \
     /* move entries */                                                         \
     int j = 0;                                                                 \
-    for (int i = mid; i < leaf->nkeys; ++i)                                    \
-      right->leaf_entries[j++] = leaf->leaf_entries[i];                        \
-    right->nkeys = j;                                                          \
+    for (int i = mid; i < leaf->hdr.nkeys; ++i, ++j) {                         \
+      right->keys[j]         = leaf->keys[i];                                  \
+      right->leaf_entries[j] = leaf->leaf_entries[i];                          \
+    }                                                                          \
+    right->hdr.nkeys = j;                                                      \
     /* shrink left */                                                          \
-    leaf->nkeys = mid;                                                         \
-    /* wire leaf list: insert right after leaf */                              \
-    list_add_tail(&right->leaf_link, &leaf->leaf_link);                        \
+    leaf->hdr.nkeys = mid;                                                     \
+    /* wire leaf list: insert right after leaf (before leaf's successor) */    \
+    list_add_tail(&right->leaf_link, leaf->leaf_link.next);                    \
     return right;                                                              \
   }                                                                            \
                                                                                \
-  /* split internal node */                                                    \
-  static inline name##_node *name##_split_internal(name##_node *node,          \
-                                                   key_type    *up_key) {         \
-    int          mid   = node->nkeys / 2; /* middle key will go up */          \
-    name##_node *right = malloc(sizeof(*right));                               \
-    if (!right) return NULL;                                                   \
-    right->is_leaf = false;                                                    \
-    right->nkeys   = 0;                                                        \
-    /* copy keys after mid (exclude mid) */                                    \
-    int j = 0;                                                                 \
-    for (int i = mid + 1; i < node->nkeys; ++i)                                \
-      right->keys[j++] = node->keys[i];                                        \
-    right->nkeys = j;                                                          \
-    /* children */                                                             \
-    for (int i = 0; i <= j; ++i)                                               \
-      right->children[i] = node->children[mid + 1 + i];                        \
-    /* shrink left */                                                          \
-    node->nkeys = mid;                                                         \
-    *up_key     = node->keys[mid];                                             \
-    return right;                                                              \
+  /* hang right (with separator sep) next to left, which is child idx[d] of    \
+   * path[d] for the deepest d = depth-1. full parents are split around the    \
+   * combined key sequence and the middle key moves up; a split root gets a    \
+   * new root above it. append splits a parent that right was appended to      \
+   * at its old last key instead: that key moves up, the left node keeps       \
+   * its first ORDER-1 children and the new node starts with the last old      \
+   * child, sep and right */                                                   \
+  static inline int name##_insert_up(name *t, name##_inner **path, int *idx,   \
+                                     int depth, name##_node *left,             \
+                                     key_type sep, name##_node *right,         \
+                                     bool append) {                            \
+    while (depth > 0) {                                                        \
+      name##_inner *p   = path[--depth];                                       \
+      int           pos = idx[depth]; /* sep goes to keys[pos] */              \
+      int           n   = p->hdr.nkeys;                                        \
+      if (n < name##_MAX_KEYS) {                                               \
+        memmove(&p->keys[pos + 1], &p->keys[pos],                              \
+                (n - pos) * sizeof(key_type));                                 \
+        memmove(&p->children[pos + 2], &p->children[pos + 1],                  \
+                (n - pos) * sizeof(name##_node *));                            \
+        p->keys[pos]         = sep;                                            \
+        p->children[pos + 1] = right;                                          \
+        p->hdr.nkeys++;                                                        \
+        if (name##_OPTS & BTREE_OPT_COUNTS) {                                  \
+          memmove(&name##_counts(p)[pos + 2], &name##_counts(p)[pos + 1],      \
+                  (n - pos) * sizeof(size_t));                                 \
+          name##_counts(p)[pos]     = name##_subtree_size(left);               \
+          name##_counts(p)[pos + 1] = name##_subtree_size(right);              \
+        }                                                                      \
+        return 0;                                                              \
+      }                                                                        \
+      name##_inner *r = name##_inner_alloc(t);                                 \
+      if (!r) return -1;                                                       \
+      BTREE_COUNT_(name##_OPTS, t, inner_splits, 1);                           \
+      /* lay the MAX_KEYS+1 keys / ORDER+1 children out in order */            \
+      key_type     keys[name##_MAX_KEYS + 1];                                  \
+      name##_node *kids[name##_ORDER + 1];                                     \
+      memcpy(keys, p->keys, pos * sizeof(key_type));                           \
+      memcpy(kids, p->children, (pos + 1) * sizeof(name##_node *));            \
+      keys[pos]     = sep;                                                     \
+      kids[pos + 1] = right;                                                   \
+      memcpy(&keys[pos + 1], &p->keys[pos], (n - pos) * sizeof(key_type));     \
+      memcpy(&kids[pos + 2], &p->children[pos + 1],                            \
+             (n - pos) * sizeof(name##_node *));                               \
+      int mid = append && pos == n ? n - 1 : (n + 1) / 2; /* goes up */        \
+      memcpy(p->keys, keys, mid * sizeof(key_type));                           \
+      memcpy(p->children, kids, (mid + 1) * sizeof(name##_node *));            \
+      p->hdr.nkeys = mid;                                                      \
+      memcpy(r->keys, &keys[mid + 1], (n - mid) * sizeof(key_type));           \
+      memcpy(r->children, &kids[mid + 1],                                      \
+             (n - mid + 1) * sizeof(name##_node *));                           \
+      r->hdr.nkeys = n - mid;                                                  \
+      if (name##_OPTS & BTREE_OPT_COUNTS) {                                    \
+        /* the counts follow their children */                                 \
+        size_t cnts[name##_ORDER + 1];                                         \
+        memcpy(cnts, name##_counts(p), pos * sizeof(size_t));                  \
+        cnts[pos]     = name##_subtree_size(left);                             \
+        cnts[pos + 1] = name##_subtree_size(right);                            \
+        memcpy(&cnts[pos + 2], &name##_counts(p)[pos + 1],                     \
+               (n - pos) * sizeof(size_t));                                    \
+        memcpy(name##_counts(p), cnts, (mid + 1) * sizeof(size_t));            \
+        memcpy(name##_counts(r), &cnts[mid + 1],                               \
+               (n - mid + 1) * sizeof(size_t));                                \
+      }                                                                        \
+      sep          = keys[mid];                                                \
+      left         = &p->hdr;                                                  \
+      right        = &r->hdr;                                                  \
+    }                                                                          \
+    name##_inner *root = name##_inner_alloc(t);                                \
+    if (!root) return -1;                                                      \
+    root->hdr.nkeys   = 1;                                                     \
+    root->keys[0]     = sep;                                                   \
+    root->children[0] = left;                                                  \
+    root->children[1] = right;                                                 \
+    if (name##_OPTS & BTREE_OPT_COUNTS) {                                      \
+      name##_counts(root)[0] = name##_subtree_size(left);                      \
+      name##_counts(root)[1] = name##_subtree_size(right);                     \
+    }                                                                          \
+    t->root = &root->hdr;                                                      \
+    return 0;                                                                  \
   }                                                                            \
                                                                                \
-  /* insert entry into tree (simplified B+ insertion) */                       \
-  static inline int name##_insert(name *t, entry_type *entry) {                \
+  /* descend to the leaf for key recording the path: child idx[d] of           \
+   * path[d] for d < *depth. upper follows separators equal to key to the      \
+   * right (as search does), !upper to the left */                             \
+  static inline name##_leaf *name##_descend(name *t, key_type key, bool upper, \
+                                            name##_inner **path, int *idx,     \
+                                            int *depth) {                      \
+    name##_node *n = t->root;                                                  \
+    *depth         = 0;                                                        \
+    BTREE_COUNT_(name##_OPTS, t, descents, 1);                                 \
+    while (!n->is_leaf) {                                                      \
+      name##_inner *in = name##_as_inner(n);                                   \
+      int           nk = in->hdr.nkeys;                                        \
+      int i = upper ? name##_count_le(in->keys, nk, key)                       \
+                    : name##_count_lt(in->keys, nk, key);                      \
+      BTREE_COUNT_(name##_OPTS, t, inner_visits, 1);                           \
+      BTREE_COUNT_(name##_OPTS, t, comparisons, name##_ncmp(nk, i));           \
+      path[*depth]    = in;                                                    \
+      idx[(*depth)++] = i;                                                     \
+      n               = in->children[i];                                       \
+    }                                                                          \
+    return name##_as_leaf(n);                                                  \
+  }                                                                            \
+                                                                               \
+  /* put entry at slot pos of leaf, the leaf insert reached through path.      \
+   * a full leaf is split at the midpoint, except when entry goes past the     \
+   * end of the last leaf: then all old entries stay put and entry starts      \
+   * the new leaf, so ascending inserts leave full leaves behind */            \
+  static inline int name##_insert_at(name *t, name##_inner **path, int *idx,   \
+                                     int depth, name##_leaf *leaf, int pos,    \
+                                     entry_type *entry) {                      \
+    if (leaf->hdr.nkeys < name##_LEAF_KEYS) {                                  \
+      name##_leaf_insert_at(leaf, pos, entry);                                 \
+      name##_count_path(path, idx, depth, 1);                                  \
+      return 0;                                                                \
+    }                                                                          \
+    bool append =                                                              \
+        pos == name##_LEAF_KEYS && leaf->leaf_link.next == &t->leaves;         \
+    int  mid = append ? name##_LEAF_KEYS : (name##_LEAF_KEYS + 1) / 2;         \
+    /* split, then insert on the side pos falls on */                          \
+    name##_leaf *right = name##_split_leaf(t, leaf, mid);                      \
+    if (!right) return -1;                                                     \
+    BTREE_COUNT_(name##_OPTS, t, leaf_splits, 1);                              \
+    if (pos >= mid)                                                            \
+      name##_leaf_insert_at(right, pos - mid, entry);                          \
+    else                                                                       \
+      name##_leaf_insert_at(leaf, pos, entry);                                 \
+    name##_count_path(path, idx, depth, 1);                                    \
+    return name##_insert_up(t, path, idx, depth, &leaf->hdr, right->keys[0],   \
+                            &right->hdr, append);                              \
+  }                                                                            \
+                                                                               \
+  /* leaf and slot (*pos, after equal keys) where key goes, with the path to   \
+   * the leaf when it is full or BTREE_OPT_COUNTS needs it. a key at or past   \
+   * the last entry of the tree goes to the end of the last leaf without a     \
+   * search; the path is then the right spine */                               \
+  static inline name##_leaf *name##_insert_leaf(name *t, key_type key,         \
+                                                name##_inner **path, int *idx, \
+                                                int *depth, int *pos) {        \
+    BTREE_COUNT_(name##_OPTS, t, inserts, 1);                                  \
+    *pos = 0;                                                                  \
     if (!t->root) {                                                            \
       /* create root as leaf */                                                \
-      name##_node *r = name##_node_alloc();                                    \
-      if (!r) return -1;                                                       \
-      r->is_leaf = true;                                                       \
-      r->nkeys   = 0;                                                          \
+      name##_leaf *r = name##_leaf_alloc(t);                                   \
+      if (!r) return NULL;                                                     \
       /* link leaf to leaf list head */                                        \
       list_add_tail(&r->leaf_link, &t->leaves);                                \
-      t->root = r;                                                             \
+      t->root = &r->hdr;                                                       \
+      *depth  = 0;                                                             \
+      return r;                                                                \
     }                                                                          \
-    /* descent, keep stack of nodes */                                         \
-    name##_node *path[64];                                                     \
-    int          path_pos = 0;                                                 \
-    name##_node *n        = t->root;                                           \
-    while (!n->is_leaf) {                                                      \
-      path[path_pos++] = n;                                                    \
-      int i            = 0;                                                    \
-      while (i < n->nkeys && CMP(entry->key_member, n->keys[i]) >= 0) i++;     \
-      n = n->children[i];                                                      \
-    }                                                                          \
-    path[path_pos++] = n;                                                      \
-    /* if leaf full, split up the path until leaf not full */                  \
-    if (n->nkeys == name##_MAX_KEYS) {                                         \
-      /* split leaf and propagate */                                           \
-      name##_node *left  = n;                                                  \
-      name##_node *right = name##_split_leaf(left);                            \
-      if (!right) return -1;                                                   \
-      /* create new parent if needed */                                        \
-      if (path_pos == 1) { /* root was leaf */                                 \
-        name##_node *newroot = malloc(sizeof(*newroot));                       \
-        if (!newroot) return -1;                                               \
-        newroot->is_leaf     = false;                                          \
-        newroot->nkeys       = 1;                                              \
-        newroot->keys[0]     = right->leaf_entries[0]->key_member;             \
-        newroot->children[0] = left;                                           \
-        newroot->children[1] = right;                                          \
-        t->root              = newroot;                                        \
-      } else {                                                                 \
-        /* insert separator into parent; we will handle propagation            \
-         * iteratively */                                                      \
-        int          insert_pos = path_pos - 2; /* parent index */             \
-        name##_node *parent     = path[insert_pos];                            \
-        /* we will insert a key = first key of right into parent; if parent    \
-         * full - split later */                                               \
-        key_type sep = right->leaf_entries[0]->key_member;                     \
-        /* shift parent's keys/children to insert */                           \
-        int k = parent->nkeys - 1;                                             \
-        while (k >= 0 && CMP(parent->keys[k], sep) > 0) {                      \
-          parent->keys[k + 1]     = parent->keys[k];                           \
-          parent->children[k + 2] = parent->children[k + 1];                   \
-          k--;                                                                 \
-        }                                                                      \
-        parent->keys[k + 1]     = sep;                                         \
-        parent->children[k + 2] = right;                                       \
-        parent->nkeys++;                                                       \
-        /* propagate splits upward if parent overflows */                      \
-        for (int pi = insert_pos;                                              \
-             pi >= 0 && path[pi]->nkeys > name##_MAX_KEYS; --pi) {             \
-          name##_node *over = path[pi];                                        \
-          key_type     upkey;                                                  \
-          name##_node *rnode = name##_split_internal(over, &upkey);            \
-          if (!rnode) return -1;                                               \
-          if (pi == 0) { /* make new root */                                   \
-            name##_node *newroot = malloc(sizeof(*newroot));                   \
-            if (!newroot) return -1;                                           \
-            newroot->is_leaf     = false;                                      \
-            newroot->nkeys       = 1;                                          \
-            newroot->keys[0]     = upkey;                                      \
-            newroot->children[0] = over;                                       \
-            newroot->children[1] = rnode;                                      \
-            t->root              = newroot;                                    \
-            break;                                                             \
-          } else {                                                             \
-            name##_node *pp = path[pi - 1];                                    \
-            /* insert upkey into pp at proper position */                      \
-            int ii = pp->nkeys - 1;                                            \
-            while (ii >= 0 && CMP(pp->keys[ii], upkey) > 0) {                  \
-              pp->keys[ii + 1]     = pp->keys[ii];                             \
-              pp->children[ii + 2] = pp->children[ii + 1];                     \
-              ii--;                                                            \
-            }                                                                  \
-            pp->keys[ii + 1]     = upkey;                                      \
-            pp->children[ii + 2] = rnode;                                      \
-            pp->nkeys++;                                                       \
-          }                                                                    \
+    name##_leaf *last = container_of(t->leaves.prev, name##_leaf, leaf_link);  \
+    int          n    = last->hdr.nkeys;                                       \
+    if (n == 0 || CMP(key, last->keys[n - 1]) < 0) {                           \
+      name##_leaf *leaf = name##_descend(t, key, true, path, idx, depth);      \
+      int          nk   = leaf->hdr.nkeys;                                     \
+      *pos              = name##_count_le(leaf->keys, nk, key);                \
+      BTREE_COUNT_(name##_OPTS, t, comparisons, name##_ncmp(nk, *pos));        \
+      return leaf;                                                             \
+    }                                                                          \
+    BTREE_COUNT_(name##_OPTS, t, appends, 1);                                  \
+    *depth = 0;                                                                \
+    *pos   = n;                                                                \
+    if (n < name##_LEAF_KEYS && !(name##_OPTS & BTREE_OPT_COUNTS))             \
+      return last;                                                             \
+    for (name##_node *c = t->root; !c->is_leaf;) {                             \
+      name##_inner *in = name##_as_inner(c);                                   \
+      path[*depth]     = in;                                                   \
+      idx[(*depth)++]  = in->hdr.nkeys;                                        \
+      c                = in->children[in->hdr.nkeys];                          \
+    }                                                                          \
+    return last;                                                               \
+  }                                                                            \
+                                                                               \
+  /* insert entry into tree, after any entries with an equal key. 0 on         \
+   * success, -1 if a node could not be allocated */                           \
+  static inline int name##_insert(name *t, entry_type *entry) {                \
+    name##_inner *path[BTREE_MAX_DEPTH];                                       \
+    int           idx[BTREE_MAX_DEPTH];                                        \
+    int           depth;                                                       \
+    key_type      key  = entry->key_member;                                    \
+    int           pos;                                                         \
+    name##_leaf  *leaf = name##_insert_leaf(t, key, path, idx, &depth, &pos);  \
+    if (!leaf) return -1;                                                      \
+    return name##_insert_at(t, path, idx, depth, leaf, pos, entry);            \
+  }                                                                            \
+                                                                               \
+  /* insert entry unless an entry with an equal key is already there.          \
+   * returns that entry, or entry itself if it was inserted; NULL if a node    \
+   * could not be allocated */                                                 \
+  static inline entry_type *name##_insert_or_get(name *t, entry_type *entry) { \
+    name##_inner *path[BTREE_MAX_DEPTH];                                       \
+    int           idx[BTREE_MAX_DEPTH];                                        \
+    int           depth;                                                       \
+    key_type      key  = entry->key_member;                                    \
+    int           pos;                                                         \
+    name##_leaf  *leaf = name##_insert_leaf(t, key, path, idx, &depth, &pos);  \
+    if (!leaf) return NULL;                                                    \
+    if (pos > 0 && CMP(leaf->keys[pos - 1], key) == 0)                         \
+      return leaf->leaf_entries[pos - 1];                                      \
+    if (name##_insert_at(t, path, idx, depth, leaf, pos, entry) != 0)          \
+      return NULL;                                                             \
+    return entry;                                                              \
+  }                                                                            \
+                                                                               \
+  /* insert entry, or put it in place of the entry with an equal key. the      \
+   * replaced entry (NULL if there was none) goes to *old when old is not      \
+   * NULL. 0 on success, -1 if a node could not be allocated */                \
+  static inline int name##_upsert(name *t, entry_type *entry,                  \
+                                  entry_type **old) {                          \
+    name##_inner *path[BTREE_MAX_DEPTH];                                       \
+    int           idx[BTREE_MAX_DEPTH];                                        \
+    int           depth;                                                       \
+    key_type      key  = entry->key_member;                                    \
+    int           pos;                                                         \
+    name##_leaf  *leaf = name##_insert_leaf(t, key, path, idx, &depth, &pos);  \
+    if (old) *old = NULL;                                                      \
+    if (!leaf) return -1;                                                      \
+    if (pos > 0 && CMP(leaf->keys[pos - 1], key) == 0) {                       \
+      if (old) *old = leaf->leaf_entries[pos - 1];                             \
+      leaf->leaf_entries[pos - 1] = entry;                                     \
+      return 0;                                                                \
+    }                                                                          \
+    return name##_insert_at(t, path, idx, depth, leaf, pos, entry);            \
+  }                                                                            \
+                                                                               \
+  /* move a path recorded by name##_descend to the next leaf to the right,     \
+   * NULL at the last leaf */                                                  \
+  static inline name##_leaf *name##_path_next(name##_inner **path, int *idx,   \
+                                              int depth) {                     \
+    int d = depth - 1;                                                         \
+    while (d >= 0 && idx[d] == path[d]->hdr.nkeys) d--;                        \
+    if (d < 0) return NULL;                                                    \
+    name##_node *n = path[d]->children[++idx[d]];                              \
+    for (d++; d < depth; d++) {                                                \
+      path[d] = name##_as_inner(n);                                            \
+      idx[d]  = 0;                                                             \
+      n       = path[d]->children[0];                                          \
+    }                                                                          \
+    return name##_as_leaf(n);                                                  \
+  }                                                                            \
+                                                                               \
+  /* node n is short of entries and should borrow or merge */                  \
+  static inline bool name##_underflow(const name *t, const name##_node *n) {   \
+    return n->nkeys == 0 ||                                                    \
+           n->nkeys < (n->is_leaf ? t->leaf_min : t->inner_min);               \
+  }                                                                            \
+                                                                               \
+  /* merge leaf r into its left neighbour l, or even them out when both do     \
+   * not fit in one node. returns true on merge (r is gone) */                 \
+  static inline bool name##_fix_leaves(name *t, name##_inner *p, int si,       \
+                                       name##_leaf *l, name##_leaf *r) {       \
+    int ln = l->hdr.nkeys, rn = r->hdr.nkeys;                                  \
+    if (ln + rn <= name##_LEAF_KEYS) {                                         \
+      memcpy(&l->keys[ln], r->keys, rn * sizeof(key_type));                    \
+      memcpy(&l->leaf_entries[ln], r->leaf_entries,                            \
+             rn * sizeof(entry_type *));                                       \
+      l->hdr.nkeys = ln + rn;                                                  \
+      if (name##_OPTS & BTREE_OPT_COUNTS)                                      \
+        name##_counts(p)[si] = (size_t)(ln + rn);                              \
+      list_del(&r->leaf_link);                                                 \
+      name##_node_free(t, &r->hdr);                                            \
+      return true;                                                             \
+    }                                                                          \
+    int want = (ln + rn) / 2; /* entries l should end up with */               \
+    if (ln > want) {          /* l lends its tail to r */                      \
+      int k = ln - want;                                                       \
+      memmove(&r->keys[k], r->keys, rn * sizeof(key_type));                    \
+      memmove(&r->leaf_entries[k], r->leaf_entries,                            \
+              rn * sizeof(entry_type *));                                      \
+      memcpy(r->keys, &l->keys[want], k * sizeof(key_type));                   \
+      memcpy(r->leaf_entries, &l->leaf_entries[want],                          \
+             k * sizeof(entry_type *));                                        \
+    } else { /* r lends its head to l */                                       \
+      int k = want - ln;                                                       \
+      memcpy(&l->keys[ln], r->keys, k * sizeof(key_type));                     \
+      memcpy(&l->leaf_entries[ln], r->leaf_entries, k * sizeof(entry_type *)); \
+      memmove(r->keys, &r->keys[k], (rn - k) * sizeof(key_type));              \
+      memmove(r->leaf_entries, &r->leaf_entries[k],                            \
+              (rn - k) * sizeof(entry_type *));                                \
+    }                                                                          \
+    l->hdr.nkeys = want;                                                       \
+    r->hdr.nkeys = ln + rn - want;                                             \
+    p->keys[si]  = r->keys[0];                                                 \
+    if (name##_OPTS & BTREE_OPT_COUNTS) {                                      \
+      name##_counts(p)[si]     = (size_t)want;                                 \
+      name##_counts(p)[si + 1] = (size_t)(ln + rn - want);                     \
+    }                                                                          \
+    return false;                                                              \
+  }                                                                            \
+                                                                               \
+  /* same for internal nodes; the separator p->keys[si] moves down into the    \
+   * merged node, or rotates through the parent when evening out */            \
+  static inline bool name##_fix_inners(name *t, name##_inner *p, int si,       \
+                                       name##_inner *l, name##_inner *r) {     \
+    int ln = l->hdr.nkeys, rn = r->hdr.nkeys;                                  \
+    if (ln + rn + 1 <= name##_MAX_KEYS) {                                      \
+      l->keys[ln] = p->keys[si];                                               \
+      memcpy(&l->keys[ln + 1], r->keys, rn * sizeof(key_type));                \
+      memcpy(&l->children[ln + 1], r->children,                                \
+             (rn + 1) * sizeof(name##_node *));                                \
+      l->hdr.nkeys = ln + rn + 1;                                              \
+      if (name##_OPTS & BTREE_OPT_COUNTS) {                                    \
+        memcpy(&name##_counts(l)[ln + 1], name##_counts(r),                    \
+               (rn + 1) * sizeof(size_t));                                     \
+        name##_counts(p)[si] += name##_counts(p)[si + 1];                      \
+      }                                                                        \
+      name##_node_free(t, &r->hdr);                                            \
+      return true;                                                             \
+    }                                                                          \
+    /* lay out l.keys, sep, r.keys and all children in order, split anew */    \
+    key_type     keys[2 * name##_MAX_KEYS + 1];                                \
+    name##_node *kids[2 * name##_ORDER];                                       \
+    memcpy(keys, l->keys, ln * sizeof(key_type));                              \
+    keys[ln] = p->keys[si];                                                    \
+    memcpy(&keys[ln + 1], r->keys, rn * sizeof(key_type));                     \
+    memcpy(kids, l->children, (ln + 1) * sizeof(name##_node *));               \
+    memcpy(&kids[ln + 1], r->children, (rn + 1) * sizeof(name##_node *));      \
+    int total = ln + rn + 1, mid = total / 2; /* keys[mid] goes up */          \
+    memcpy(l->keys, keys, mid * sizeof(key_type));                             \
+    memcpy(l->children, kids, (mid + 1) * sizeof(name##_node *));              \
+    l->hdr.nkeys = mid;                                                        \
+    memcpy(r->keys, &keys[mid + 1], (total - mid - 1) * sizeof(key_type));     \
+    memcpy(r->children, &kids[mid + 1],                                        \
+           (total - mid) * sizeof(name##_node *));                             \
+    r->hdr.nkeys = total - mid - 1;                                            \
+    p->keys[si]  = keys[mid];                                                  \
+    if (name##_OPTS & BTREE_OPT_COUNTS) {                                      \
+      size_t cnts[2 * name##_ORDER];                                           \
+      memcpy(cnts, name##_counts(l), (ln + 1) * sizeof(size_t));               \
+      memcpy(&cnts[ln + 1], name##_counts(r), (rn + 1) * sizeof(size_t));      \
+      memcpy(name##_counts(l), cnts, (mid + 1) * sizeof(size_t));              \
+      memcpy(name##_counts(r), &cnts[mid + 1],                                 \
+             (total - mid) * sizeof(size_t));                                  \
+      name##_counts(p)[si]     = name##_subtree_size(&l->hdr);                 \
+      name##_counts(p)[si + 1] = name##_subtree_size(&r->hdr);                 \
+    }                                                                          \
+    return false;                                                              \
+  }                                                                            \
+                                                                               \
+  /* walk up from the leaf at the end of path, merging or evening out          \
+   * nodes that fell below their threshold, then drop empty roots */           \
+  static inline void name##_rebalance(name *t, name##_inner **path, int *idx,  \
+                                      int depth) {                             \
+    while (depth > 0) {                                                        \
+      name##_inner *p  = path[--depth];                                        \
+      int           ci = idx[depth];                                           \
+      if (!name##_underflow(t, p->children[ci])) break;                        \
+      int  si = ci > 0 ? ci - 1 : 0; /* separator between the pair */          \
+      bool merged =                                                            \
+          p->children[si]->is_leaf                                             \
+              ? name##_fix_leaves(t, p, si,                                    \
+                                  name##_as_leaf(p->children[si]),             \
+                                  name##_as_leaf(p->children[si + 1]))         \
+              : name##_fix_inners(t, p, si,                                    \
+                                  name##_as_inner(p->children[si]),            \
+                                  name##_as_inner(p->children[si + 1]));       \
+      if (!merged) break;                                                      \
+      int n = p->hdr.nkeys;                                                    \
+      memmove(&p->keys[si], &p->keys[si + 1],                                  \
+              (n - si - 1) * sizeof(key_type));                                \
+      memmove(&p->children[si + 1], &p->children[si + 2],                      \
+              (n - si - 1) * sizeof(name##_node *));                           \
+      if (name##_OPTS & BTREE_OPT_COUNTS)                                      \
+        memmove(&name##_counts(p)[si + 1], &name##_counts(p)[si + 2],          \
+                (n - si - 1) * sizeof(size_t));                                \
+      p->hdr.nkeys--;                                                          \
+    }                                                                          \
+    while (!t->root->is_leaf && t->root->nkeys == 0) {                         \
+      name##_node *old = t->root;                                              \
+      t->root          = name##_as_inner(old)->children[0];                    \
+      name##_node_free(t, old);                                                \
+    }                                                                          \
+    if (t->root->is_leaf && t->root->nkeys == 0) {                             \
+      name##_node_free(t, t->root);                                            \
+      t->root = NULL;                                                          \
+      INIT_LIST_HEAD(&t->leaves);                                              \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  /* remove one entry with key, merging with or borrowing from siblings        \
+   * as nodes shrink. returns the removed entry, NULL if key is absent */      \
+  static inline entry_type *name##_erase(name *t, key_type key) {              \
+    if (!t->root) return NULL;                                                 \
+    name##_inner *path[BTREE_MAX_DEPTH];                                       \
+    int           idx[BTREE_MAX_DEPTH];                                        \
+    int           depth;                                                       \
+    name##_leaf  *leaf = name##_descend(t, key, false, path, idx, &depth);     \
+    int           i    = name##_count_lt(leaf->keys, leaf->hdr.nkeys, key);    \
+    /* key equal to a separator: its first copy starts the next leaf */        \
+    while (i == leaf->hdr.nkeys) {                                             \
+      if (!(leaf = name##_path_next(path, idx, depth))) return NULL;           \
+      i = 0;                                                                   \
+    }                                                                          \
+    if (CMP(leaf->keys[i], key) != 0) return NULL;                             \
+    entry_type *e = leaf->leaf_entries[i];                                     \
+    int         n = leaf->hdr.nkeys;                                           \
+    memmove(&leaf->keys[i], &leaf->keys[i + 1],                                \
+            (n - i - 1) * sizeof(key_type));                                   \
+    memmove(&leaf->leaf_entries[i], &leaf->leaf_entries[i + 1],                \
+            (n - i - 1) * sizeof(entry_type *));                               \
+    leaf->hdr.nkeys--;                                                         \
+    name##_count_path(path, idx, depth, -1);                                   \
+    name##_rebalance(t, path, idx, depth);                                     \
+    return e;                                                                  \
+  }                                                                            \
+                                                                               \
+  /* merge thresholds: a node borrows from or merges with a sibling once it    \
+   * holds fewer than leaf_min entries / inner_min keys, or none at all.       \
+   * the default is a quarter of each node: the halves of a split have to      \
+   * lose a quarter of their capacity before they merge again, so a key        \
+   * going back and forth at the boundary does not split and merge on every    \
+   * operation. half gives the textbook B+ tree (and that thrash); 0 defers    \
+   * merging until a node is empty. values are clamped to [0, capacity/2] */   \
+  static inline void name##_set_merge_thresholds(name *t, int leaf_min,        \
+                                                 int inner_min) {              \
+    int leaf_cap  = name##_LEAF_KEYS / 2;                                      \
+    int inner_cap = name##_MAX_KEYS / 2;                                       \
+    t->leaf_min   = leaf_min < 0          ? 0                                  \
+                    : leaf_min > leaf_cap ? leaf_cap                           \
+                                          : leaf_min;                          \
+    t->inner_min  = inner_min < 0           ? 0                                \
+                    : inner_min > inner_cap ? inner_cap                        \
+                                            : inner_min;                       \
+  }                                                                            \
+                                                                               \
+  /* bulk load: spread count items over the fewest groups of at most cap */    \
+  static inline size_t name##_bulk_groups(size_t count, size_t cap) {          \
+    return (count + cap - 1) / cap;                                            \
+  }                                                                            \
+                                                                               \
+  /* stack internal levels on top of a complete level of nodes, left to        \
+   * right. nodes/mins (min key under each node) are reused level by level.    \
+   * on failure every node under nodes[] is freed */                           \
+  static inline int name##_bulk_index(name *t, name##_node **nodes,            \
+                                      key_type *mins, size_t count,            \
+                                      size_t cap) {                            \
+    while (count > 1) {                                                        \
+      size_t nparents = name##_bulk_groups(count, cap);                        \
+      if (count / nparents < 2) nparents = count / 2;                          \
+      size_t base = count / nparents, extra = count % nparents;                \
+      name##_inner **parents = malloc(nparents * sizeof(*parents));            \
+      size_t         got     = 0;                                              \
+      if (parents)                                                             \
+        for (; got < nparents; ++got)                                          \
+          if (!(parents[got] = name##_inner_alloc(t))) break;                  \
+      if (got < nparents) {                                                    \
+        for (size_t i = 0; i < got; ++i)                                       \
+          name##_node_free(t, &parents[i]->hdr);                               \
+        for (size_t i = 0; i < count; ++i) name##_free_subtree(t, nodes[i]);   \
+        free(parents);                                                         \
+        return -1;                                                             \
+      }                                                                        \
+      size_t c = 0;                                                            \
+      for (size_t p = 0; p < nparents; ++p) {                                  \
+        name##_inner *parent = parents[p];                                     \
+        size_t        nc     = base + (p < extra);                             \
+        parent->hdr.nkeys    = (int)nc - 1;                                    \
+        for (size_t j = 0; j < nc; ++j, ++c) {                                 \
+          parent->children[j] = nodes[c];                                      \
+          if (j) parent->keys[j - 1] = mins[c];                                \
+          if (name##_OPTS & BTREE_OPT_COUNTS)                                  \
+            name##_counts(parent)[j] = name##_subtree_size(nodes[c]);          \
         }                                                                      \
+        mins[p] = mins[c - nc];                                                \
       }                                                                        \
+      for (size_t p = 0; p < nparents; ++p) nodes[p] = &parents[p]->hdr;       \
+      free(parents);                                                           \
+      count = nparents;                                                        \
     }                                                                          \
-    /* now find leaf again (may have changed) and insert */                    \
-    name##_node *leaf = name##_find_leaf(t, entry->key_member);                \
-    if (!leaf) return -1;                                                      \
-    /* insert into leaf (leaf guaranteed not full now) */                      \
-    name##_leaf_insert_nofull(leaf, entry);                                    \
+    t->root = nodes[0];                                                        \
     return 0;                                                                  \
   }                                                                            \
                                                                                \
+  /* build the tree bottom-up from n entries sorted by key, replacing its      \
+   * contents. fill_factor in (0, 1] is the share of each node that gets       \
+   * used; 1.0 packs leaves and internal nodes full. linear time, one pass     \
+   * over the entries. returns -1 (and leaves the tree empty) if entries       \
+   * are out of order or memory runs out */                                    \
+  static inline int name##_bulk_load(name *t, entry_type *const *entries,      \
+                                     size_t n, double fill_factor) {           \
+    name##_clear(t);                                                           \
+    if (n == 0) return 0;                                                      \
+    for (size_t i = 1; i < n; ++i)                                             \
+      if (CMP(entries[i - 1]->key_member, entries[i]->key_member) > 0)         \
+        return -1;                                                             \
+    if (!(fill_factor > 0.0) || fill_factor > 1.0) fill_factor = 1.0;          \
+    size_t leaf_cap = (size_t)(fill_factor * name##_LEAF_KEYS + 0.5);          \
+    size_t node_cap = (size_t)(fill_factor * name##_ORDER + 0.5);              \
+    if (leaf_cap < 1) leaf_cap = 1;                                            \
+    if (node_cap < 2) node_cap = 2;                                            \
+                                                                               \
+    size_t        nleaves = name##_bulk_groups(n, leaf_cap);                   \
+    size_t        base = n / nleaves, extra = n % nleaves;                     \
+    name##_node **nodes = malloc(nleaves * sizeof(*nodes));                    \
+    key_type     *mins  = malloc(nleaves * sizeof(*mins));                     \
+    size_t        e = 0, l = 0;                                                \
+    if (nodes && mins)                                                         \
+      for (; l < nleaves; ++l) {                                               \
+        name##_leaf *leaf = name##_leaf_alloc(t);                              \
+        if (!leaf) break;                                                      \
+        size_t cnt = base + (l < extra);                                       \
+        for (size_t i = 0; i < cnt; ++i, ++e) {                                \
+          leaf->keys[i]         = entries[e]->key_member;                      \
+          leaf->leaf_entries[i] = entries[e];                                  \
+        }                                                                      \
+        leaf->hdr.nkeys = (int)cnt;                                            \
+        list_add_tail(&leaf->leaf_link, &t->leaves);                           \
+        nodes[l] = &leaf->hdr;                                                 \
+        mins[l]  = leaf->keys[0];                                              \
+      }                                                                        \
+    int rc = -1;                                                               \
+    if (l < nleaves)                                                           \
+      for (size_t i = 0; i < l; ++i) name##_node_free(t, nodes[i]);            \
+    else                                                                       \
+      rc = name##_bulk_index(t, nodes, mins, nleaves, node_cap);               \
+    if (rc != 0) INIT_LIST_HEAD(&t->leaves);                                   \
+    free(nodes);                                                               \
+    free(mins);                                                                \
+    return rc;                                                                 \
+  }                                                                            \
+                                                                               \
   /* iterate over all entries in order: callback(entry*, ctx) */               \
   static inline void name##_iterate(name *t, void (*cb)(entry_type *, void *), \
                                     void *ctx) {                               \
     list_head *h = &t->leaves;                                                 \
     for (list_head *p = h->next; p != h; p = p->next) {                        \
-      name##_node *leaf = container_of(p, name##_node, leaf_link);             \
-      for (int i = 0; i < leaf->nkeys; ++i) cb(leaf->leaf_entries[i], ctx);    \
+      name##_leaf *leaf = container_of(p, name##_leaf, leaf_link);             \
+      BTREE_COUNT_(name##_OPTS, t, iterate_leaves, 1);                         \
+      for (int i = 0; i < leaf->hdr.nkeys; ++i)                                \
+        cb(leaf->leaf_entries[i], ctx);                                        \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  static inline void name##_stats_walk(const name##_node *n, int depth,        \
+                                       btree_stats *out) {                     \
+    if (depth > out->height) out->height = depth;                              \
+    if (n->is_leaf) {                                                          \
+      out->leaves++;                                                           \
+      out->entries += n->nkeys;                                                \
+      out->leaf_hist[btree_fill_bucket(n->nkeys, name##_LEAF_KEYS)]++;         \
+      return;                                                                  \
+    }                                                                          \
+    const name##_inner *in = (const name##_inner *)n;                          \
+    out->inners++;                                                             \
+    out->inner_hist[btree_fill_bucket(n->nkeys + 1, name##_ORDER)]++;          \
+    for (int i = 0; i <= n->nkeys; ++i)                                        \
+      name##_stats_walk(in->children[i], depth + 1, out);                      \
+  }                                                                            \
+                                                                               \
+  /* walk the whole tree and fill *out with its shape and t->counters.         \
+   * O(nodes); meant for tuning and monitoring, not hot paths */               \
+  static inline void name##_stats(const name *t, btree_stats *out) {           \
+    memset(out, 0, sizeof(*out));                                              \
+    out->counters = t->counters;                                               \
+    if (t->root) name##_stats_walk(t->root, 1, out);                           \
+    out->node_bytes = out->leaves * sizeof(name##_leaf) +                      \
+                      out->inners * name##_INNER_BYTES;                        \
+    if (out->leaves)                                                           \
+      out->leaf_fill = (double)out->entries /                                  \
+                       ((double)out->leaves * name##_LEAF_KEYS);               \
+    if (out->inners)                                                           \
+      out->inner_fill = (double)(out->leaves + out->inners - 1) /              \
+                        ((double)out->inners * name##_ORDER);                  \
+    for (const list_head *p = t->leaves.next; p != &t->leaves; p = p->next)    \
+      out->chain_length++;                                                     \
+  }                                                                            \
+                                                                               \
+  /* position of one entry in the leaf chain. leaf == NULL is the end          \
+   * position, one past the last entry (and one before the first) */           \
+  typedef struct name##_cursor {                                               \
+    name##_leaf *leaf;                                                         \
+    int          slot;                                                         \
+    list_head   *head; /* the tree's leaves list */                            \
+  } name##_cursor;                                                             \
+                                                                               \
+  static inline bool name##_cursor_valid(const name##_cursor *c) {             \
+    return c->leaf != NULL;                                                    \
+  }                                                                            \
+                                                                               \
+  static inline entry_type *name##_cursor_entry(const name##_cursor *c) {      \
+    return c->leaf->leaf_entries[c->slot];                                     \
+  }                                                                            \
+                                                                               \
+  static inline key_type name##_cursor_key(const name##_cursor *c) {           \
+    return c->leaf->keys[c->slot];                                             \
+  }                                                                            \
+                                                                               \
+  /* point c at slot of the leaf linked at p, moving forward over empty        \
+   * leaves; the end position when the chain runs out */                       \
+  static inline void name##_cursor_seek(name##_cursor *c, list_head *p,        \
+                                        int slot) {                            \
+    while (p != c->head) {                                                     \
+      name##_leaf *leaf = container_of(p, name##_leaf, leaf_link);             \
+      if (slot < leaf->hdr.nkeys) {                                            \
+        c->leaf = leaf;                                                        \
+        c->slot = slot;                                                        \
+        return;                                                                \
+      }                                                                        \
+      p    = p->next;                                                          \
+      slot = 0;                                                                \
     }                                                                          \
+    c->leaf = NULL;                                                            \
+  }                                                                            \
+                                                                               \
+  static inline void name##_cursor_next(name##_cursor *c) {                    \
+    if (!c->leaf) return;                                                      \
+    if (c->slot + 1 < c->leaf->hdr.nkeys)                                      \
+      c->slot++;                                                               \
+    else                                                                       \
+      name##_cursor_seek(c, c->leaf->leaf_link.next, 0);                       \
+  }                                                                            \
+                                                                               \
+  /* step back; from the end position this lands on the last entry */          \
+  static inline void name##_cursor_prev(name##_cursor *c) {                    \
+    if (c->leaf && c->slot > 0) {                                              \
+      c->slot--;                                                               \
+      return;                                                                  \
+    }                                                                          \
+    list_head *p = c->leaf ? c->leaf->leaf_link.prev : c->head->prev;          \
+    for (; p != c->head; p = p->prev) {                                        \
+      name##_leaf *leaf = container_of(p, name##_leaf, leaf_link);             \
+      if (leaf->hdr.nkeys) {                                                   \
+        c->leaf = leaf;                                                        \
+        c->slot = leaf->hdr.nkeys - 1;                                         \
+        return;                                                                \
+      }                                                                        \
+    }                                                                          \
+    c->leaf = NULL;                                                            \
+  }                                                                            \
+                                                                               \
+  static inline name##_cursor name##_cursor_first(name *t) {                   \
+    name##_cursor c = {.head = &t->leaves};                                    \
+    name##_cursor_seek(&c, t->leaves.next, 0);                                 \
+    return c;                                                                  \
+  }                                                                            \
+                                                                               \
+  static inline name##_cursor name##_cursor_last(name *t) {                    \
+    name##_cursor c = {.leaf = NULL, .head = &t->leaves};                      \
+    name##_cursor_prev(&c);                                                    \
+    return c;                                                                  \
+  }                                                                            \
+                                                                               \
+  /* first entry with key > key (upper) or >= key (!upper). the descent        \
+   * for >= goes left of separators equal to key, so runs of duplicate keys    \
+   * that straddle a split are found from their first entry */                 \
+  static inline name##_cursor name##_cursor_bound(name *t, key_type key,       \
+                                                  bool upper) {                \
+    name##_cursor c = {.leaf = NULL, .head = &t->leaves};                      \
+    name##_node  *n = t->root;                                                 \
+    if (!n) return c;                                                          \
+    while (!n->is_leaf) {                                                      \
+      name##_inner *in = name##_as_inner(n);                                   \
+      int           nk = in->hdr.nkeys;                                        \
+      int i = upper ? name##_count_le(in->keys, nk, key)                       \
+                    : name##_count_lt(in->keys, nk, key);                      \
+      n     = in->children[i];                                                 \
+    }                                                                          \
+    name##_leaf *leaf = name##_as_leaf(n);                                     \
+    int          nk   = leaf->hdr.nkeys;                                       \
+    int          slot = upper ? name##_count_le(leaf->keys, nk, key)           \
+                              : name##_count_lt(leaf->keys, nk, key);          \
+    name##_cursor_seek(&c, &leaf->leaf_link, slot);                            \
+    return c;                                                                  \
+  }                                                                            \
+                                                                               \
+  /* first entry with key >= key */                                            \
+  static inline name##_cursor name##_lower_bound(name *t, key_type key) {      \
+    return name##_cursor_bound(t, key, false);                                 \
+  }                                                                            \
+                                                                               \
+  /* first entry with key > key */                                             \
+  static inline name##_cursor name##_upper_bound(name *t, key_type key) {      \
+    return name##_cursor_bound(t, key, true);                                  \
+  }                                                                            \
+                                                                               \
+  /* true while c is on an entry with key < hi */                              \
+  static inline bool name##_cursor_before(const name##_cursor *c,              \
+                                          key_type             hi) {           \
+    return c->leaf && CMP(c->leaf->keys[c->slot], hi) < 0;                     \
+  }                                                                            \
+                                                                               \
+  /* batched range scan: hand back the entries from c up to the end of its     \
+   * leaf that have key < hi as one contiguous slice of leaf_entries, and      \
+   * move c past them. returns the slice length, 0 once the range is done:     \
+   *                                                                           \
+   *   name##_cursor c = name##_lower_bound(t, lo);                            \
+   *   entry_type *const *s;                                                   \
+   *   for (int n; (n = name##_cursor_slice(&c, hi, &s)) > 0;)                 \
+   *     for (int i = 0; i < n; ++i) use(s[i]);                                \
+   */                                                                          \
+  static inline int name##_cursor_slice(name##_cursor *c, key_type hi,         \
+                                        entry_type *const **out) {             \
+    if (!c->leaf) return 0;                                                    \
+    name##_leaf *leaf = c->leaf;                                               \
+    int          rest = leaf->hdr.nkeys - c->slot;                             \
+    int          n    = name##_count_lt(&leaf->keys[c->slot], rest, hi);       \
+    *out              = &leaf->leaf_entries[c->slot];                          \
+    if (n == rest)                                                             \
+      name##_cursor_seek(c, leaf->leaf_link.next, 0);                          \
+    else                                                                       \
+      c->slot += n;                                                            \
+    return n;                                                                  \
+  }                                                                            \
+                                                                               \
+  /* number of entries with key < key. O(log n) with BTREE_OPT_COUNTS,         \
+   * otherwise a walk over the leaves before the one key falls in */           \
+  static inline size_t name##_rank(name *t, key_type key) {                    \
+    name##_node *n    = t->root;                                               \
+    size_t       rank = 0;                                                     \
+    if (!n) return 0;                                                          \
+    if (!(name##_OPTS & BTREE_OPT_COUNTS)) {                                   \
+      name##_cursor c = name##_lower_bound(t, key);                            \
+      for (list_head *p = t->leaves.next;                                      \
+           p != (c.leaf ? &c.leaf->leaf_link : &t->leaves); p = p->next)       \
+        rank += (size_t)container_of(p, name##_leaf, leaf_link)->hdr.nkeys;    \
+      return c.leaf ? rank + (size_t)c.slot : rank;                            \
+    }                                                                          \
+    /* left of separators equal to key, as name##_lower_bound: the             \
+     * children before slot i only hold keys < key */                          \
+    while (!n->is_leaf) {                                                      \
+      name##_inner *in = name##_as_inner(n);                                   \
+      int           i  = name##_count_lt(in->keys, in->hdr.nkeys, key);        \
+      for (int j = 0; j < i; ++j) rank += name##_counts(in)[j];                \
+      n = in->children[i];                                                     \
+    }                                                                          \
+    name##_leaf *leaf = name##_as_leaf(n);                                     \
+    return rank + (size_t)name##_count_lt(leaf->keys, leaf->hdr.nkeys, key);   \
+  }                                                                            \
+                                                                               \
+  /* entry at 0-based position i in key order, NULL when i is past the         \
+   * end. O(log n) with BTREE_OPT_COUNTS, a walk over the leaves without */    \
+  static inline entry_type *name##_select(name *t, size_t i) {                 \
+    name##_node *n = t->root;                                                  \
+    if (!n) return NULL;                                                       \
+    if (!(name##_OPTS & BTREE_OPT_COUNTS)) {                                   \
+      for (list_head *p = t->leaves.next; p != &t->leaves; p = p->next) {      \
+        name##_leaf *leaf = container_of(p, name##_leaf, leaf_link);           \
+        if (i < (size_t)leaf->hdr.nkeys) return leaf->leaf_entries[i];         \
+        i -= (size_t)leaf->hdr.nkeys;                                          \
+      }                                                                        \
+      return NULL;                                                             \
+    }                                                                          \
+    while (!n->is_leaf) {                                                      \
+      name##_inner *in = name##_as_inner(n);                                   \
+      int           j  = 0;                                                    \
+      while (j < in->hdr.nkeys && i >= name##_counts(in)[j])                   \
+        i -= name##_counts(in)[j++];                                           \
+      n = in->children[j];                                                     \
+    }                                                                          \
+    name##_leaf *leaf = name##_as_leaf(n);                                     \
+    return i < (size_t)leaf->hdr.nkeys ? leaf->leaf_entries[i] : NULL;         \
+  }                                                                            \
+                                                                               \
+  /* number of entries with lo <= key < hi */                                  \
+  static inline size_t name##_count_range(name *t, key_type lo, key_type hi) { \
+    if (CMP(lo, hi) >= 0) return 0;                                            \
+    return name##_rank(t, hi) - name##_rank(t, lo);                            \
   }
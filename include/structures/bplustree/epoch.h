@@ -0,0 +1,160 @@
+#pragma once
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Epoch-based reclamation for the concurrent trees (DEFINE_BTREE_OLC).
+//
+// A thread attaches to a domain once and gets a slot. Around every
+// operation it enters (publishing the global epoch in its slot) and exits
+// (clearing it). Memory unlinked from the shared structure is retired to
+// the thread's limbo list, tagged with the global epoch at that time. The
+// global epoch only moves from g to g+1 once every thread inside an
+// operation has entered at g, so when it reaches tag+2 no thread can still
+// hold a pointer read before the unlink and the memory is freed.
+//
+// Limbo lists of detached threads go to the domain and are freed by
+// btree_epoch_destroy, which must run when no thread is attached.
+
+#define BTREE_EPOCH_MAX_THREADS  64
+#define BTREE_EPOCH_RETIRE_BATCH 64 /* retires between collections */
+
+typedef struct btree_epoch_slot {
+  _Alignas(64) _Atomic uint64_t active; /* epoch entered, 0 outside */
+  _Atomic int used;
+} btree_epoch_slot;
+
+typedef struct btree_limbo_item {
+  void    *ptr;
+  uint64_t epoch;
+} btree_limbo_item;
+
+typedef struct btree_limbo {
+  btree_limbo_item *items;
+  size_t            n, cap;
+} btree_limbo;
+
+typedef struct btree_epoch {
+  _Atomic uint64_t global; /* starts at 1 so that 0 can mean idle */
+  btree_epoch_slot slots[BTREE_EPOCH_MAX_THREADS];
+  pthread_mutex_t  lock;    /* guards orphans */
+  btree_limbo      orphans; /* left behind by detached threads */
+} btree_epoch;
+
+static inline void btree_epoch_init(btree_epoch *e) {
+  atomic_init(&e->global, 1);
+  for (int i = 0; i < BTREE_EPOCH_MAX_THREADS; ++i) {
+    atomic_init(&e->slots[i].active, 0);
+    atomic_init(&e->slots[i].used, 0);
+  }
+  pthread_mutex_init(&e->lock, NULL);
+  e->orphans = (btree_limbo){0};
+}
+
+static inline void btree_limbo_free_all(btree_limbo *l) {
+  for (size_t i = 0; i < l->n; ++i) free(l->items[i].ptr);
+  free(l->items);
+  *l = (btree_limbo){0};
+}
+
+static inline void btree_epoch_destroy(btree_epoch *e) {
+  btree_limbo_free_all(&e->orphans);
+  pthread_mutex_destroy(&e->lock);
+}
+
+/* slot for the calling thread, -1 when all are taken */
+static inline int btree_epoch_attach(btree_epoch *e) {
+  for (int i = 0; i < BTREE_EPOCH_MAX_THREADS; ++i) {
+    int free_slot = 0;
+    if (atomic_compare_exchange_strong(&e->slots[i].used, &free_slot, 1))
+      return i;
+  }
+  return -1;
+}
+
+static inline void btree_epoch_enter(btree_epoch *e, int slot) {
+  /* the slot must be visible before any shared pointer is read. the
+   * seq_cst store alone orders that on x86 and keeps tools that ignore
+   * fences (TSan) honest; the fence orders it for the plain loads */
+  atomic_store(&e->slots[slot].active,
+               atomic_load_explicit(&e->global, memory_order_relaxed));
+  atomic_thread_fence(memory_order_seq_cst);
+}
+
+static inline void btree_epoch_exit(btree_epoch *e, int slot) {
+  atomic_store_explicit(&e->slots[slot].active, 0, memory_order_release);
+}
+
+/* move the global epoch on if every active thread has caught up */
+static inline uint64_t btree_epoch_advance(btree_epoch *e) {
+  uint64_t g = atomic_load(&e->global);
+  for (int i = 0; i < BTREE_EPOCH_MAX_THREADS; ++i) {
+    uint64_t a = atomic_load(&e->slots[i].active);
+    if (a && a != g) return g;
+  }
+  atomic_compare_exchange_strong(&e->global, &g, g + 1);
+  return atomic_load(&e->global);
+}
+
+/* free what no thread can reach any more */
+static inline void btree_epoch_collect(btree_epoch *e, btree_limbo *l) {
+  uint64_t g    = btree_epoch_advance(e);
+  size_t   kept = 0;
+  for (size_t i = 0; i < l->n; ++i) {
+    if (l->items[i].epoch + 2 <= g)
+      free(l->items[i].ptr);
+    else
+      l->items[kept++] = l->items[i];
+  }
+  l->n = kept;
+}
+
+/* free p once no thread inside an operation can still see it. if the
+ * limbo list cannot grow, wait for the epoch to pass instead */
+static inline void btree_epoch_retire(btree_epoch *e, btree_limbo *l,
+                                      void *p) {
+  if (l->n == l->cap) {
+    size_t            cap   = l->cap ? 2 * l->cap : BTREE_EPOCH_RETIRE_BATCH;
+    btree_limbo_item *items = realloc(l->items, cap * sizeof(*items));
+    if (items) {
+      l->items = items;
+      l->cap   = cap;
+    }
+  }
+  if (l->n < l->cap) {
+    l->items[l->n++] = (btree_limbo_item){p, atomic_load(&e->global)};
+    if (l->n % BTREE_EPOCH_RETIRE_BATCH == 0) btree_epoch_collect(e, l);
+    return;
+  }
+  /* out of memory: the caller is outside any operation, so waiting for
+   * two epochs cannot deadlock against itself */
+  uint64_t target = atomic_load(&e->global) + 2;
+  while (btree_epoch_advance(e) < target) sched_yield();
+  free(p);
+}
+
+/* release the slot; whatever is still in limbo goes to the domain */
+static inline void btree_epoch_detach(btree_epoch *e, int slot,
+                                      btree_limbo *l) {
+  btree_epoch_collect(e, l);
+  pthread_mutex_lock(&e->lock);
+  for (size_t i = 0; i < l->n; ++i) {
+    btree_limbo *o = &e->orphans;
+    if (o->n == o->cap) {
+      size_t            cap = o->cap ? 2 * o->cap : BTREE_EPOCH_RETIRE_BATCH;
+      btree_limbo_item *items = realloc(o->items, cap * sizeof(*items));
+      if (!items) break; /* leaks the rest rather than freeing too early */
+      o->items = items;
+      o->cap   = cap;
+    }
+    o->items[o->n++] = l->items[i];
+  }
+  pthread_mutex_unlock(&e->lock);
+  free(l->items);
+  *l = (btree_limbo){0};
+  atomic_store(&e->slots[slot].active, 0);
+  atomic_store(&e->slots[slot].used, 0);
+}
@@ -12,6 +12,7 @@ static inline int int_cmp(const int a, const int b) {
   return (a > b) - (a < b);
 }
 #define CMP_INT(a, b) int_cmp((a), (b))
-DEFINE_BTREE(intinttree, IntIntBPlusTree, int, key, 4, CMP_INT)
+DEFINE_BTREE_SIZED_OPTS(intinttree, IntIntBPlusTree, int, key, 256, CMP_INT,
+                        BTREE_OPT_INT_KEYS)
 
 STRUCTURES_EXTERN void printIntIntBPlusTree(IntIntBPlusTree *, void *);
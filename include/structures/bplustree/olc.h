@@ -0,0 +1,462 @@
+#pragma once
+
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "structures/bplustree/epoch.h"
+
+// Thread-safe B+ tree with optimistic lock coupling.
+//
+// Every node has a version word. Readers take no latches: they note a
+// node's version, read the node, and check that the version has not moved
+// before trusting what they read or stepping into a child. If it moved
+// they restart from the root. Writers latch only the nodes they change:
+// the leaf they add to or remove from, and a node being split together
+// with its parent. Full internal nodes are split on the way down, so a
+// split never has to reach past the parent.
+//
+// Erase unlinks a leaf that loses its last key and hands it to the tree's
+// epoch domain (epoch.h), which frees it once no reader can still be
+// inside. Internal nodes are never merged or freed.
+//
+// Nodes are read and written with relaxed atomics while other threads may
+// be reading them, so key_type must be an integer or pointer type. Keys
+// are unique.
+//
+// DEFINE_BTREE_OLC(name, entry_type, key_type, key_member, ORDER, CMP)
+// gives
+//   name##_init / name##_destroy - not thread-safe
+//   name##_attach(t, th)         - 0, or -1 if BTREE_EPOCH_MAX_THREADS
+//                                  threads are attached; each thread
+//                                  attaches its own name##_thread once
+//                                  before the calls below
+//   name##_detach(th)
+//   name##_search(th, key)       - entry or NULL
+//   name##_insert_or_get(th, e)  - e, or the entry that already has e's
+//                                  key, or NULL out of memory
+//   name##_erase(th, key)        - the removed entry, or NULL
+//   name##_iterate(t, cb, ctx)   - in key order; not thread-safe
+// ORDER and CMP mean the same as for DEFINE_BTREE.
+
+// Version word: bit 0 marks a node unlinked, bit 1 is the write latch and
+// the bits above count completed writes.
+#define BTREE_OLC_OBSOLETE 1u
+#define BTREE_OLC_LOCKED   2u
+#define BTREE_OLC_FRESH    4u /* version of a new node */
+
+// restarts that spin before a restart yields the CPU instead
+#define BTREE_OLC_SPINS 16
+
+#define BTREE_OLC_LOAD_(x)     __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define BTREE_OLC_STORE_(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+
+/* wait a little before restarting; a latch holder may be off the CPU */
+static inline void btree_olc_backoff(int *tries) {
+  if (++*tries > BTREE_OLC_SPINS) {
+    sched_yield();
+    return;
+  }
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+/* version to read the node at, or 0 if it is latched or unlinked */
+static inline uint64_t btree_olc_read_lock(_Atomic uint64_t *version) {
+  uint64_t v = atomic_load_explicit(version, memory_order_acquire);
+  return v & (BTREE_OLC_OBSOLETE | BTREE_OLC_LOCKED) ? 0 : v;
+}
+
+/* true if no write to the node started since read_lock returned v */
+static inline bool btree_olc_validate(_Atomic uint64_t *version, uint64_t v) {
+  atomic_thread_fence(memory_order_acquire);
+  return atomic_load_explicit(version, memory_order_relaxed) == v;
+}
+
+/* latch the node if it is still at version v */
+static inline bool btree_olc_upgrade(_Atomic uint64_t *version, uint64_t v) {
+  if (!atomic_compare_exchange_strong_explicit(version, &v,
+                                               v + BTREE_OLC_LOCKED,
+                                               memory_order_acquire,
+                                               memory_order_relaxed))
+    return false;
+  /* a reader that sees any of the writes that follow sees the latch */
+  atomic_thread_fence(memory_order_release);
+  return true;
+}
+
+static inline void btree_olc_unlock(_Atomic uint64_t *version) {
+  atomic_fetch_add_explicit(version, BTREE_OLC_LOCKED, memory_order_release);
+}
+
+/* unlatch for good: readers that reach the node restart */
+static inline void btree_olc_unlock_obsolete(_Atomic uint64_t *version) {
+  atomic_fetch_add_explicit(version, BTREE_OLC_LOCKED | BTREE_OLC_OBSOLETE,
+                            memory_order_release);
+}
+
+#define DEFINE_BTREE_OLC(name, entry_type, key_type, key_member, ORDER, CMP)   \
+  enum { name##_ORDER = (ORDER), name##_MAX_KEYS = (ORDER) - 1 };              \
+  _Static_assert((ORDER) >= 3, #name ": ORDER must be at least 3");            \
+  _Static_assert(sizeof(key_type) <= 8, #name ": key_type must be scalar");    \
+                                                                               \
+  /* header shared by both node layouts */                                     \
+  typedef struct name##_node {                                                 \
+    _Atomic uint64_t version; /* see BTREE_OLC_LOCKED */                       \
+    int              nkeys;                                                    \
+    bool             is_leaf; /* fixed when the node is made */                \
+    key_type         keys[name##_MAX_KEYS];                                    \
+  } name##_node;                                                               \
+                                                                               \
+  typedef struct name##_inner {                                                \
+    name##_node  hdr;                                                          \
+    name##_node *children[name##_ORDER];                                       \
+  } name##_inner;                                                              \
+                                                                               \
+  typedef struct name##_leaf {                                                 \
+    name##_node hdr;                                                           \
+    entry_type *entries[name##_MAX_KEYS];                                      \
+  } name##_leaf;                                                               \
+                                                                               \
+  typedef struct name {                                                        \
+    name##_node *root; /* NULL until the first insert */                       \
+    btree_epoch  epoch;                                                        \
+  } name;                                                                      \
+                                                                               \
+  /* what a thread needs to work on the tree, see name##_attach */             \
+  typedef struct name##_thread {                                               \
+    name       *tree;                                                          \
+    int         slot;  /* in tree->epoch */                                    \
+    btree_limbo limbo; /* leaves this thread unlinked, not yet freed */        \
+  } name##_thread;                                                             \
+                                                                               \
+  static inline void name##_init(name *t) {                                    \
+    t->root = NULL;                                                            \
+    btree_epoch_init(&t->epoch);                                               \
+  }                                                                            \
+                                                                               \
+  static inline void name##_free_nodes(name##_node *n) {                       \
+    if (!n->is_leaf)                                                           \
+      for (int i = 0; i <= n->nkeys; ++i)                                      \
+        name##_free_nodes(((name##_inner *)n)->children[i]);                   \
+    free(n);                                                                   \
+  }                                                                            \
+                                                                               \
+  /* every thread must have detached */                                        \
+  static inline void name##_destroy(name *t) {                                 \
+    if (t->root) name##_free_nodes(t->root);                                   \
+    t->root = NULL;                                                            \
+    btree_epoch_destroy(&t->epoch);                                            \
+  }                                                                            \
+                                                                               \
+  static inline int name##_attach(name *t, name##_thread *th) {                \
+    th->tree  = t;                                                             \
+    th->limbo = (btree_limbo){0};                                              \
+    th->slot  = btree_epoch_attach(&t->epoch);                                 \
+    return th->slot < 0 ? -1 : 0;                                              \
+  }                                                                            \
+                                                                               \
+  static inline void name##_detach(name##_thread *th) {                        \
+    btree_epoch_detach(&th->tree->epoch, th->slot, &th->limbo);                \
+  }                                                                            \
+                                                                               \
+  static inline name##_node *name##_alloc(bool leaf) {                         \
+    name##_node *n =                                                           \
+        calloc(1, leaf ? sizeof(name##_leaf) : sizeof(name##_inner));          \
+    if (!n) return NULL;                                                       \
+    atomic_init(&n->version, BTREE_OLC_FRESH);                                 \
+    n->is_leaf = leaf;                                                         \
+    return n;                                                                  \
+  }                                                                            \
+                                                                               \
+  static inline name##_node *name##_root(name *t) {                            \
+    return __atomic_load_n(&t->root, __ATOMIC_ACQUIRE);                        \
+  }                                                                            \
+                                                                               \
+  static inline name##_node *name##_child(name##_node *n, int i) {             \
+    return __atomic_load_n(&((name##_inner *)n)->children[i],                  \
+                           __ATOMIC_ACQUIRE);                                  \
+  }                                                                            \
+                                                                               \
+  static inline void name##_set_child(name##_node *n, int i,                   \
+                                      name##_node *c) {                        \
+    __atomic_store_n(&((name##_inner *)n)->children[i], c,                     \
+                     __ATOMIC_RELEASE);                                        \
+  }                                                                            \
+                                                                               \
+  /* keys of n that are < key (upper: <= key). n may be read                   \
+   * optimistically, so the caller validates before trusting the result */     \
+  static inline int name##_count(name##_node *n, key_type key,                 \
+                                 bool upper) {                                 \
+    int nk = BTREE_OLC_LOAD_(n->nkeys);                                        \
+    int i  = 0;                                                                \
+    if (upper)                                                                 \
+      while (i < nk && CMP(BTREE_OLC_LOAD_(n->keys[i]), key) <= 0) i++;        \
+    else                                                                       \
+      while (i < nk && CMP(BTREE_OLC_LOAD_(n->keys[i]), key) < 0) i++;         \
+    return i;                                                                  \
+  }                                                                            \
+                                                                               \
+  /* read root n, loaded from t, at the version left in *v. false if n is      \
+   * latched or no longer the root: a root split shrinks the old root to       \
+   * its left half and publishes the new root before unlatching it, so a       \
+   * reader that reads n after the split sees the new root here */             \
+  static inline bool name##_read_root(name *t, name##_node *n, uint64_t *v) {  \
+    if (!(*v = btree_olc_read_lock(&n->version))) return false;                \
+    return name##_root(t) == n;                                                \
+  }                                                                            \
+                                                                               \
+  /* from n, read at version *v, to the child key routes to, read at the       \
+   * version left in *v. NULL if either node changed: restart. n is checked    \
+   * again after the child's version is read, or a split of both could         \
+   * slip in between and leave key in a node this path never sees */           \
+  static inline name##_node *name##_descend(name##_node *n, key_type key,      \
+                                            uint64_t *v) {                     \
+    uint64_t     pv = *v;                                                      \
+    name##_node *c  = name##_child(n, name##_count(n, key, true));             \
+    if (!btree_olc_validate(&n->version, pv)) return NULL;                     \
+    if (!(*v = btree_olc_read_lock(&c->version))) return NULL;                 \
+    if (!btree_olc_validate(&n->version, pv)) return NULL;                     \
+    return c;                                                                  \
+  }                                                                            \
+                                                                               \
+  /* one optimistic attempt; false to retry */                                 \
+  static inline bool name##_search_once(name *t, key_type key,                 \
+                                        entry_type **out) {                    \
+    name##_node *n = name##_root(t);                                           \
+    uint64_t     v;                                                            \
+    *out = NULL;                                                               \
+    if (!n) return true;                                                       \
+    if (!name##_read_root(t, n, &v)) return false;                             \
+    while (!n->is_leaf)                                                        \
+      if (!(n = name##_descend(n, key, &v))) return false;                     \
+    int         i = name##_count(n, key, false);                               \
+    entry_type *e = NULL;                                                      \
+    if (i < BTREE_OLC_LOAD_(n->nkeys) &&                                       \
+        CMP(BTREE_OLC_LOAD_(n->keys[i]), key) == 0)                            \
+      e = BTREE_OLC_LOAD_(((name##_leaf *)n)->entries[i]);                     \
+    if (!btree_olc_validate(&n->version, v)) return false;                     \
+    *out = e;                                                                  \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  static inline entry_type *name##_search(name##_thread *th, key_type key) {   \
+    entry_type *e;                                                             \
+    int         tries = 0;                                                     \
+    btree_epoch_enter(&th->tree->epoch, th->slot);                             \
+    while (!name##_search_once(th->tree, key, &e)) btree_olc_backoff(&tries);  \
+    btree_epoch_exit(&th->tree->epoch, th->slot);                              \
+    return e;                                                                  \
+  }                                                                            \
+                                                                               \
+  /* split full n, latched, and add the new right node to latched parent       \
+   * p, or to a new root above n if p is NULL. false if out of memory */       \
+  static inline bool name##_split(name *t, name##_node *p, name##_node *n) {   \
+    name##_node *r    = name##_alloc(n->is_leaf);                              \
+    name##_node *root = NULL;                                                  \
+    if (!r || (!p && !(root = name##_alloc(false)))) {                         \
+      free(r);                                                                 \
+      return false;                                                            \
+    }                                                                          \
+    /* fill r while it is private, then shrink n and publish r */              \
+    int      nk  = n->nkeys;                                                   \
+    int      mid = nk / 2;                                                     \
+    key_type sep;                                                              \
+    if (n->is_leaf) {                                                          \
+      for (int i = mid; i < nk; ++i) {                                         \
+        r->keys[i - mid] = n->keys[i];                                         \
+        ((name##_leaf *)r)->entries[i - mid] =                                 \
+            ((name##_leaf *)n)->entries[i];                                    \
+      }                                                                        \
+      r->nkeys = nk - mid;                                                     \
+      sep      = r->keys[0];                                                   \
+    } else {                                                                   \
+      for (int i = mid + 1; i < nk; ++i) r->keys[i - mid - 1] = n->keys[i];    \
+      for (int i = mid + 1; i <= nk; ++i)                                      \
+        ((name##_inner *)r)->children[i - mid - 1] =                           \
+            ((name##_inner *)n)->children[i];                                  \
+      r->nkeys = nk - mid - 1;                                                 \
+      sep      = n->keys[mid];                                                 \
+    }                                                                          \
+    BTREE_OLC_STORE_(n->nkeys, mid);                                           \
+    if (!p) {                                                                  \
+      root->keys[0]                       = sep;                               \
+      root->nkeys                         = 1;                                 \
+      ((name##_inner *)root)->children[0] = n;                                 \
+      ((name##_inner *)root)->children[1] = r;                                 \
+      __atomic_store_n(&t->root, root, __ATOMIC_RELEASE);                      \
+      return true;                                                             \
+    }                                                                          \
+    int pos = name##_count(p, sep, true);                                      \
+    for (int i = p->nkeys; i > pos; --i) {                                     \
+      BTREE_OLC_STORE_(p->keys[i], p->keys[i - 1]);                            \
+      name##_set_child(p, i + 1, ((name##_inner *)p)->children[i]);            \
+    }                                                                          \
+    BTREE_OLC_STORE_(p->keys[pos], sep);                                       \
+    name##_set_child(p, pos + 1, r);                                           \
+    BTREE_OLC_STORE_(p->nkeys, p->nkeys + 1);                                  \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  /* one optimistic attempt; false to retry. Full nodes met on the way         \
+   * down are split, so the parent of a splitting node always has room */      \
+  static inline bool name##_insert_once(name *t, entry_type *e,                \
+                                        entry_type **out) {                    \
+    key_type     key = e->key_member;                                          \
+    name##_node *p   = NULL;                                                   \
+    name##_node *n   = name##_root(t);                                         \
+    uint64_t     pv  = 0, v;                                                   \
+    if (!n) {                                                                  \
+      name##_node *none = NULL;                                                \
+      if (!(n = name##_alloc(true))) {                                         \
+        *out = NULL;                                                           \
+        return true;                                                           \
+      }                                                                        \
+      if (!__atomic_compare_exchange_n(&t->root, &none, n, false,              \
+                                       __ATOMIC_RELEASE, __ATOMIC_RELAXED))    \
+        free(n);                                                               \
+      return false;                                                            \
+    }                                                                          \
+    if (!name##_read_root(t, n, &v)) return false;                             \
+    for (;;) {                                                                 \
+      if (BTREE_OLC_LOAD_(n->nkeys) == name##_MAX_KEYS) {                      \
+        /* latch parent, then node; a node without one must be the root */     \
+        if (p && !btree_olc_upgrade(&p->version, pv)) return false;            \
+        if (!btree_olc_upgrade(&n->version, v)) {                              \
+          if (p) btree_olc_unlock(&p->version);                                \
+          return false;                                                        \
+        }                                                                      \
+        bool ok = p || name##_root(t) == n;                                    \
+        if (ok && !name##_split(t, p, n)) {                                    \
+          btree_olc_unlock(&n->version);                                       \
+          if (p) btree_olc_unlock(&p->version);                                \
+          *out = NULL;                                                         \
+          return true;                                                         \
+        }                                                                      \
+        btree_olc_unlock(&n->version);                                         \
+        if (p) btree_olc_unlock(&p->version);                                  \
+        return false;                                                          \
+      }                                                                        \
+      if (n->is_leaf) break;                                                   \
+      p  = n;                                                                  \
+      pv = v;                                                                  \
+      if (!(n = name##_descend(n, key, &v))) return false;                     \
+    }                                                                          \
+    name##_leaf *leaf = (name##_leaf *)n;                                      \
+    int          pos  = name##_count(n, key, false);                           \
+    if (pos < BTREE_OLC_LOAD_(n->nkeys) &&                                     \
+        CMP(BTREE_OLC_LOAD_(n->keys[pos]), key) == 0) {                        \
+      entry_type *old = BTREE_OLC_LOAD_(leaf->entries[pos]);                   \
+      if (!btree_olc_validate(&n->version, v)) return false;                   \
+      *out = old;                                                              \
+      return true;                                                             \
+    }                                                                          \
+    /* only the leaf is latched; its version vouches for pos */                \
+    if (!btree_olc_upgrade(&n->version, v)) return false;                      \
+    for (int i = n->nkeys; i > pos; --i) {                                     \
+      BTREE_OLC_STORE_(n->keys[i], n->keys[i - 1]);                            \
+      BTREE_OLC_STORE_(leaf->entries[i], leaf->entries[i - 1]);                \
+    }                                                                          \
+    BTREE_OLC_STORE_(n->keys[pos], key);                                       \
+    BTREE_OLC_STORE_(leaf->entries[pos], e);                                   \
+    BTREE_OLC_STORE_(n->nkeys, n->nkeys + 1);                                  \
+    btree_olc_unlock(&n->version);                                             \
+    *out = e;                                                                  \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  /* e, the entry that already has e's key, or NULL if out of memory */        \
+  static inline entry_type *name##_insert_or_get(name##_thread *th,            \
+                                                 entry_type    *e) {           \
+    entry_type *res;                                                           \
+    int         tries = 0;                                                     \
+    btree_epoch_enter(&th->tree->epoch, th->slot);                             \
+    while (!name##_insert_once(th->tree, e, &res)) btree_olc_backoff(&tries);  \
+    btree_epoch_exit(&th->tree->epoch, th->slot);                              \
+    return res;                                                                \
+  }                                                                            \
+                                                                               \
+  /* one optimistic attempt; false to retry. A leaf losing its last key        \
+   * is unlinked from its parent, if that keeps a key, and left in *dead       \
+   * to be retired */                                                          \
+  static inline bool name##_erase_once(name *t, key_type key,                  \
+                                       entry_type **out,                       \
+                                       name##_node **dead) {                   \
+    name##_node *p  = NULL;                                                    \
+    name##_node *n  = name##_root(t);                                          \
+    uint64_t     pv = 0, v;                                                    \
+    *out            = NULL;                                                    \
+    if (!n) return true;                                                       \
+    if (!name##_read_root(t, n, &v)) return false;                             \
+    while (!n->is_leaf) {                                                      \
+      p  = n;                                                                  \
+      pv = v;                                                                  \
+      if (!(n = name##_descend(n, key, &v))) return false;                     \
+    }                                                                          \
+    name##_leaf *leaf = (name##_leaf *)n;                                      \
+    int          nk   = BTREE_OLC_LOAD_(n->nkeys);                             \
+    int          pos  = name##_count(n, key, false);                           \
+    if (pos >= nk || CMP(BTREE_OLC_LOAD_(n->keys[pos]), key) != 0)             \
+      return btree_olc_validate(&n->version, v);                               \
+    bool unlink = nk == 1 && p && BTREE_OLC_LOAD_(p->nkeys) > 0;               \
+    if (unlink && !btree_olc_upgrade(&p->version, pv)) return false;           \
+    if (!btree_olc_upgrade(&n->version, v)) {                                  \
+      if (unlink) btree_olc_unlock(&p->version);                               \
+      return false;                                                            \
+    }                                                                          \
+    *out = leaf->entries[pos];                                                 \
+    if (unlink) {                                                              \
+      /* n's range goes to its left neighbour, or right if n is first */       \
+      int idx = name##_count(p, key, true);                                    \
+      for (int i = idx ? idx - 1 : 0; i + 1 < p->nkeys; ++i)                   \
+        BTREE_OLC_STORE_(p->keys[i], p->keys[i + 1]);                          \
+      for (int i = idx; i < p->nkeys; ++i)                                     \
+        name##_set_child(p, i, ((name##_inner *)p)->children[i + 1]);          \
+      BTREE_OLC_STORE_(p->nkeys, p->nkeys - 1);                                \
+      btree_olc_unlock_obsolete(&n->version);                                  \
+      btree_olc_unlock(&p->version);                                           \
+      *dead = n;                                                               \
+      return true;                                                             \
+    }                                                                          \
+    for (int i = pos; i + 1 < nk; ++i) {                                       \
+      BTREE_OLC_STORE_(n->keys[i], n->keys[i + 1]);                            \
+      BTREE_OLC_STORE_(leaf->entries[i], leaf->entries[i + 1]);                \
+    }                                                                          \
+    BTREE_OLC_STORE_(n->nkeys, nk - 1);                                        \
+    btree_olc_unlock(&n->version);                                             \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  /* the removed entry, or NULL if key is not in the tree */                   \
+  static inline entry_type *name##_erase(name##_thread *th, key_type key) {    \
+    entry_type  *e;                                                            \
+    name##_node *dead  = NULL;                                                 \
+    int          tries = 0;                                                    \
+    btree_epoch_enter(&th->tree->epoch, th->slot);                             \
+    while (!name##_erase_once(th->tree, key, &e, &dead))                       \
+      btree_olc_backoff(&tries);                                               \
+    btree_epoch_exit(&th->tree->epoch, th->slot);                              \
+    if (dead) btree_epoch_retire(&th->tree->epoch, &th->limbo, dead);          \
+    return e;                                                                  \
+  }                                                                            \
+                                                                               \
+  static inline void name##_iterate_node(name##_node *n,                       \
+                                         void (*cb)(entry_type *, void *),     \
+                                         void *ctx) {                          \
+    if (n->is_leaf) {                                                          \
+      for (int i = 0; i < n->nkeys; ++i)                                       \
+        cb(((name##_leaf *)n)->entries[i], ctx);                               \
+      return;                                                                  \
+    }                                                                          \
+    for (int i = 0; i <= n->nkeys; ++i)                                        \
+      name##_iterate_node(((name##_inner *)n)->children[i], cb, ctx);          \
+  }                                                                            \
+                                                                               \
+  static inline void name##_iterate(name *t,                                   \
+                                    void (*cb)(entry_type *, void *),          \
+                                    void *ctx) {                               \
+    if (t->root) name##_iterate_node(t->root, cb, ctx);                        \
+  }
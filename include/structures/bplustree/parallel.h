@@ -0,0 +1,272 @@
+#pragma once
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "structures/bplustree/bplustree.h"
+
+// Multi-threaded operations on a B+ tree, added to tree name (defined by
+// DEFINE_BTREE*) with DEFINE_BTREE_PARALLEL(name):
+//   name##_parallel_scan(t, nthreads, acc_size, identity, visit, merge,
+//                        ctx, out)         - map/reduce over every entry
+//   name##_bulk_load_parallel(t, entries, n, fill_factor, nthreads)
+//                                          - name##_bulk_load, leaves
+//                                            filled by several threads
+// Only code using them needs pthreads.
+//
+// Fork/join helper for the parallel tree operations.
+//
+// btree_run_parallel(n, fn, jobs, job_size) calls fn on each of the n jobs
+// laid out job_size bytes apart. Jobs 1..n-1 each get a thread and job 0
+// runs on the caller; a job whose thread cannot be started runs on the
+// caller too, so every job always runs. Returns once all have finished.
+
+#define BTREE_PARALLEL_MAX_THREADS 256
+
+static inline void btree_run_parallel(int n, void *(*fn)(void *), void *jobs,
+                                      size_t job_size) {
+  pthread_t tid[BTREE_PARALLEL_MAX_THREADS];
+  int       started[BTREE_PARALLEL_MAX_THREADS];
+  char     *job = jobs;
+  if (n > BTREE_PARALLEL_MAX_THREADS) n = BTREE_PARALLEL_MAX_THREADS;
+  for (int i = 1; i < n; ++i) {
+    started[i] = pthread_create(&tid[i], NULL, fn, job + i * job_size) == 0;
+    if (!started[i]) fn(job + i * job_size);
+  }
+  if (n > 0) fn(job);
+  for (int i = 1; i < n; ++i)
+    if (started[i]) pthread_join(tid[i], NULL);
+}
+
+#define DEFINE_BTREE_PARALLEL(name)                                            \
+  DEFINE_BTREE_PARALLEL_(name, name##_key_t, name##_entry_t)
+
+#define DEFINE_BTREE_PARALLEL_(name, key_type, entry_type)                     \
+  /* one slice of a parallel bulk load: leaves [first, end) */                 \
+  typedef struct name##_bulk_job {                                             \
+    name              *t;                                                      \
+    entry_type *const *entries;                                                \
+    name##_node      **nodes; /* preallocated with BTREE_OPT_ARENA */          \
+    key_type          *mins;                                                   \
+    size_t             first, end, base, extra;                                \
+    int                failed; /* 1: out of order, 2: out of memory */         \
+  } name##_bulk_job;                                                           \
+                                                                               \
+  static inline void *name##_bulk_worker(void *arg) {                          \
+    name##_bulk_job   *job = arg;                                              \
+    entry_type *const *ent = job->entries;                                     \
+    size_t             e   = job->first * job->base +                          \
+                 (job->first < job->extra ? job->first : job->extra);          \
+    for (size_t l = job->first; l < job->end; ++l) {                           \
+      name##_leaf *leaf = (name##_leaf *)job->nodes[l];                        \
+      if (!leaf && !(leaf = name##_leaf_alloc(job->t))) {                      \
+        job->failed = 2;                                                       \
+        return NULL;                                                           \
+      }                                                                        \
+      job->nodes[l] = &leaf->hdr; /* freed from here if the load fails */      \
+      size_t cnt = job->base + (l < job->extra);                               \
+      /* every entry against the one before it, also across leaves and         \
+       * slices */                                                             \
+      for (size_t i = 0; i < cnt; ++i, ++e) {                                  \
+        if (e > 0 && name##_cmp(name##_key_of(ent[e - 1]),                     \
+                                name##_key_of(ent[e])) > 0) {                  \
+          job->failed = 1;                                                     \
+          return NULL;                                                         \
+        }                                                                      \
+        leaf->keys[i]         = name##_key_of(ent[e]);                         \
+        leaf->leaf_entries[i] = ent[e];                                        \
+      }                                                                        \
+      leaf->hdr.nkeys = (int)cnt;                                              \
+      job->mins[l]    = leaf->keys[0];                                         \
+      /* chain the leaves of this slice, the ends are stitched later */        \
+      if (l > job->first) {                                                    \
+        name##_leaf *prev    = (name##_leaf *)job->nodes[l - 1];               \
+        prev->leaf_link.next = &leaf->leaf_link;                               \
+        leaf->leaf_link.prev = &prev->leaf_link;                               \
+      }                                                                        \
+    }                                                                          \
+    return NULL;                                                               \
+  }                                                                            \
+                                                                               \
+  /* name##_bulk_load with the leaf level built by up to nthreads threads,     \
+   * each filling and chaining its own run of leaves; the runs are then        \
+   * stitched into the leaf list and indexed. with BTREE_OPT_ARENA the         \
+   * leaves are carved out up front, the arena is not thread-safe */           \
+  static inline int name##_bulk_load_parallel(name *t,                         \
+                                              entry_type *const *entries,      \
+                                              size_t n, double fill_factor,    \
+                                              int nthreads) {                  \
+    if (nthreads > BTREE_PARALLEL_MAX_THREADS)                                 \
+      nthreads = BTREE_PARALLEL_MAX_THREADS;                                   \
+    if (nthreads <= 1) return name##_bulk_load(t, entries, n, fill_factor);    \
+    name##_clear(t);                                                           \
+    if (n == 0) return 0;                                                      \
+    if (!(fill_factor > 0.0) || fill_factor > 1.0) fill_factor = 1.0;          \
+    size_t leaf_cap = (size_t)(fill_factor * name##_LEAF_KEYS + 0.5);          \
+    size_t node_cap = (size_t)(fill_factor * name##_ORDER + 0.5);              \
+    if (leaf_cap < 1) leaf_cap = 1;                                            \
+    if (node_cap < 2) node_cap = 2;                                            \
+                                                                               \
+    size_t           nleaves = name##_bulk_groups(n, leaf_cap);                \
+    name##_node    **nodes   = calloc(nleaves, sizeof(*nodes));                \
+    key_type        *mins    = malloc(nleaves * sizeof(*mins));                \
+    name##_bulk_job *jobs    = calloc((size_t)nthreads, sizeof(*jobs));        \
+    int              failed  = !nodes || !mins || !jobs;                       \
+    if (!failed && (name##_OPTS & BTREE_OPT_ARENA))                            \
+      for (size_t l = 0; l < nleaves; ++l)                                     \
+        if (!(nodes[l] = (name##_node *)name##_leaf_alloc(t))) {               \
+          failed = 1;                                                          \
+          break;                                                               \
+        }                                                                      \
+    if (!failed) {                                                             \
+      if ((size_t)nthreads > nleaves) nthreads = (int)nleaves;                 \
+      for (int j = 0; j < nthreads; ++j)                                       \
+        jobs[j] = (name##_bulk_job){                                           \
+            .t       = t,                                                      \
+            .entries = entries,                                                \
+            .nodes   = nodes,                                                  \
+            .mins    = mins,                                                   \
+            .first   = nleaves * (size_t)j / (size_t)nthreads,                 \
+            .end     = nleaves * (size_t)(j + 1) / (size_t)nthreads,           \
+            .base    = n / nleaves,                                            \
+            .extra   = n % nleaves,                                            \
+        };                                                                     \
+      btree_run_parallel(nthreads, name##_bulk_worker, jobs, sizeof(*jobs));   \
+      for (int j = 0; j < nthreads; ++j) failed |= jobs[j].failed;             \
+    }                                                                          \
+    int rc = -1;                                                               \
+    if (failed) {                                                              \
+      if (nodes)                                                               \
+        for (size_t l = 0; l < nleaves; ++l)                                   \
+          if (nodes[l]) name##_node_free(t, nodes[l]);                         \
+    } else {                                                                   \
+      /* stitch the runs: only the ends of each run still need links */        \
+      list_head *prev = &t->leaves;                                            \
+      for (int j = 0; j < nthreads; ++j) {                                     \
+        name##_leaf *a    = (name##_leaf *)nodes[jobs[j].first];               \
+        name##_leaf *b    = (name##_leaf *)nodes[jobs[j].end - 1];             \
+        prev->next        = &a->leaf_link;                                     \
+        a->leaf_link.prev = prev;                                              \
+        prev              = &b->leaf_link;                                     \
+      }                                                                        \
+      prev->next     = &t->leaves;                                             \
+      t->leaves.prev = prev;                                                   \
+      rc             = name##_bulk_index(t, nodes, mins, nleaves, node_cap);   \
+      if (rc != 0) INIT_LIST_HEAD(&t->leaves);                                 \
+    }                                                                          \
+    free(nodes);                                                               \
+    free(mins);                                                                \
+    free(jobs);                                                                \
+    return rc;                                                                 \
+  }                                                                            \
+                                                                               \
+  /* leftmost leaf under n */                                                  \
+  static inline name##_leaf *name##_first_leaf(name##_node *n) {               \
+    while (!n->is_leaf) n = name##_as_inner(n)->children[0];                   \
+    return name##_as_leaf(n);                                                  \
+  }                                                                            \
+                                                                               \
+  /* split the key space into at most max ranges of similar size, using        \
+   * the separators of the shallowest level that has 4 nodes per range (or     \
+   * the leaves). starts[i] is the first leaf of range i; returns the          \
+   * number of ranges, -1 if out of memory */                                  \
+  static inline int name##_partition(name *t, int max, name##_leaf **starts) { \
+    if (!t->root || max < 1) return 0;                                         \
+    size_t        want  = (size_t)max * 4;                                     \
+    size_t        count = 1;                                                   \
+    name##_node **level = malloc(sizeof(*level));                              \
+    if (!level) return -1;                                                     \
+    level[0] = t->root;                                                        \
+    while (count < want && !level[0]->is_leaf) {                               \
+      size_t next = 0;                                                         \
+      for (size_t i = 0; i < count; ++i) next += level[i]->nkeys + 1;          \
+      name##_node **below = malloc(next * sizeof(*below));                     \
+      if (!below) {                                                            \
+        free(level);                                                           \
+        return -1;                                                             \
+      }                                                                        \
+      size_t k = 0;                                                            \
+      for (size_t i = 0; i < count; ++i) {                                     \
+        name##_inner *in = name##_as_inner(level[i]);                          \
+        for (int c = 0; c <= in->hdr.nkeys; ++c) below[k++] = in->children[c]; \
+      }                                                                        \
+      free(level);                                                             \
+      level = below;                                                           \
+      count = next;                                                            \
+    }                                                                          \
+    int parts = count < (size_t)max ? (int)count : max;                        \
+    for (int i = 0; i < parts; ++i)                                            \
+      starts[i] = name##_first_leaf(level[count * (size_t)i / (size_t)parts]); \
+    free(level);                                                               \
+    return parts;                                                              \
+  }                                                                            \
+                                                                               \
+  /* one range of a parallel scan: leaves from first up to (not including)     \
+   * stop, folded into acc */                                                  \
+  typedef struct name##_scan_job {                                             \
+    name##_leaf *first;                                                        \
+    list_head   *stop;                                                         \
+    void        *acc;                                                          \
+    void (*visit)(entry_type *, void *, void *);                               \
+    void *ctx;                                                                 \
+  } name##_scan_job;                                                           \
+                                                                               \
+  static inline void *name##_scan_worker(void *arg) {                          \
+    name##_scan_job *job = arg;                                                \
+    /* locals: visit may write anywhere, keep the loop state out of memory */  \
+    void (*visit)(entry_type *, void *, void *) = job->visit;                  \
+    void      *acc  = job->acc, *ctx = job->ctx;                               \
+    list_head *stop = job->stop;                                               \
+    for (list_head *p = &job->first->leaf_link; p != stop; p = p->next) {      \
+      name##_leaf *leaf = container_of(p, name##_leaf, leaf_link);             \
+      for (int i = 0; i < leaf->hdr.nkeys; ++i)                                \
+        visit(leaf->leaf_entries[i], acc, ctx);                                \
+    }                                                                          \
+    return NULL;                                                               \
+  }                                                                            \
+                                                                               \
+  /* reduce over every entry with up to nthreads threads. the key space is     \
+   * cut along internal separators into ranges that each thread walks as       \
+   * its own piece of the leaf chain. visit(e, acc, ctx) folds an entry        \
+   * into the range's accumulator, acc_size bytes that start as a copy of      \
+   * identity; merge(into, from, ctx) then folds the ranges' accumulators      \
+   * into out from left to right, so merge need not commute. 0 on success,     \
+   * -1 if out of memory */                                                    \
+  static inline int name##_parallel_scan(                                      \
+      name *t, int nthreads, size_t acc_size, const void *identity,            \
+      void (*visit)(entry_type *, void *, void *),                             \
+      void (*merge)(void *, const void *, void *), void *ctx, void *out) {     \
+    memcpy(out, identity, acc_size);                                           \
+    if (nthreads > BTREE_PARALLEL_MAX_THREADS)                                 \
+      nthreads = BTREE_PARALLEL_MAX_THREADS;                                   \
+    if (nthreads < 1) nthreads = 1;                                            \
+    name##_leaf *starts[BTREE_PARALLEL_MAX_THREADS];                           \
+    int          parts = name##_partition(t, nthreads, starts);                \
+    if (parts <= 0) return parts;                                              \
+    /* accumulators on separate cache lines */                                 \
+    size_t           stride = (acc_size + 63) & ~(size_t)63;                   \
+    char            *accs   = malloc(stride * (size_t)parts);                  \
+    name##_scan_job *jobs   = malloc(sizeof(*jobs) * (size_t)parts);           \
+    if (!accs || !jobs) {                                                      \
+      free(accs);                                                              \
+      free(jobs);                                                              \
+      return -1;                                                               \
+    }                                                                          \
+    for (int i = 0; i < parts; ++i) {                                          \
+      jobs[i] = (name##_scan_job){                                             \
+          .first = starts[i],                                                  \
+          .stop  = i + 1 < parts ? &starts[i + 1]->leaf_link : &t->leaves,     \
+          .acc   = accs + stride * (size_t)i,                                  \
+          .visit = visit,                                                      \
+          .ctx   = ctx,                                                        \
+      };                                                                       \
+      memcpy(jobs[i].acc, identity, acc_size);                                 \
+    }                                                                          \
+    btree_run_parallel(parts, name##_scan_worker, jobs, sizeof(*jobs));        \
+    for (int i = 0; i < parts; ++i) merge(out, jobs[i].acc, ctx);              \
+    free(accs);                                                                \
+    free(jobs);                                                                \
+    return 0;                                                                  \
+  }
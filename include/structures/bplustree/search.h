@@ -0,0 +1,223 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define BTREE_SEARCH_X86 1
+#else
+#define BTREE_SEARCH_X86 0
+#endif
+
+// Node search kernels for built-in integer keys.
+//
+// btree_count_le_*(keys, n, key) - number of keys[0..n) that are <= *key
+// btree_count_lt_*(keys, n, key) - number of keys[0..n) that are <  *key
+//
+// keys must be sorted ascending. Both results are the child/slot index a
+// B+ tree descends to, computed without data-dependent branches: runs of
+// up to BTREE_SEARCH_SPAN keys are compared all at once and longer nodes
+// are first narrowed with a branchless binary search. Signed keys use AVX2
+// when the CPU has it (checked once at runtime), SSE2 otherwise for 32-bit
+// keys; unsigned keys use a scalar compare-and-add loop. Keys are passed
+// as void pointers so the kernels can be picked with _Generic for any
+// key_type. Trees only use them for nodes of BTREE_SEARCH_MIN_KEYS or more.
+// The pieces (btree_narrow_i*, btree_{scalar,sse2,avx2}_count_lt_*) are
+// usable on their own; bplustree_bench times each of them.
+
+#define BTREE_SEARCH_SPAN     32
+#define BTREE_SEARCH_MIN_KEYS 8
+
+/* long and long long keys share the 64-bit kernels, so reads go through
+ * types that may alias either */
+typedef int32_t __attribute__((may_alias)) btree_key_i32;
+typedef int64_t __attribute__((may_alias)) btree_key_i64;
+typedef uint32_t __attribute__((may_alias)) btree_key_u32;
+typedef uint64_t __attribute__((may_alias)) btree_key_u64;
+
+static inline bool btree_cpu_avx2(void) {
+#if BTREE_SEARCH_X86
+  /* threads racing on the first call all store the same answer */
+  static _Atomic int has = -1;
+  int                v   = atomic_load_explicit(&has, memory_order_relaxed);
+  if (v < 0) {
+    __builtin_cpu_init();
+    v = __builtin_cpu_supports("avx2") ? 1 : 0;
+    atomic_store_explicit(&has, v, memory_order_relaxed);
+  }
+  return v;
+#else
+  return false;
+#endif
+}
+
+#if BTREE_SEARCH_X86
+__attribute__((target("avx2"))) static inline int
+btree_avx2_count_lt_i32(const btree_key_i32 *k, int n, int32_t x) {
+  __m256i xv = _mm256_set1_epi32(x);
+  int     c  = 0, i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(k + i));
+    __m256  m = _mm256_castsi256_ps(_mm256_cmpgt_epi32(xv, v));
+    c += __builtin_popcount((unsigned)_mm256_movemask_ps(m));
+  }
+  for (; i < n; ++i) c += k[i] < x;
+  return c;
+}
+
+__attribute__((target("avx2"))) static inline int
+btree_avx2_count_lt_i64(const btree_key_i64 *k, int n, int64_t x) {
+  __m256i xv = _mm256_set1_epi64x(x);
+  int     c  = 0, i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(k + i));
+    __m256d m = _mm256_castsi256_pd(_mm256_cmpgt_epi64(xv, v));
+    c += __builtin_popcount((unsigned)_mm256_movemask_pd(m));
+  }
+  for (; i < n; ++i) c += k[i] < x;
+  return c;
+}
+#endif
+
+#if BTREE_SEARCH_X86
+static inline int btree_sse2_count_lt_i32(const btree_key_i32 *k, int n,
+                                          int32_t x) {
+  __m128i xv = _mm_set1_epi32(x);
+  int     c  = 0, i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(k + i));
+    __m128  m = _mm_castsi128_ps(_mm_cmpgt_epi32(xv, v));
+    c += __builtin_popcount((unsigned)_mm_movemask_ps(m));
+  }
+  for (; i < n; ++i) c += k[i] < x;
+  return c;
+}
+#endif
+
+/* scalar kernels: compare-and-add over every key, no early exit */
+static inline int btree_scalar_count_lt_i32(const btree_key_i32 *k, int n,
+                                            int32_t x) {
+  int c = 0;
+  for (int i = 0; i < n; ++i) c += k[i] < x;
+  return c;
+}
+
+static inline int btree_scalar_count_lt_i64(const btree_key_i64 *k, int n,
+                                            int64_t x) {
+  int c = 0;
+  for (int i = 0; i < n; ++i) c += k[i] < x;
+  return c;
+}
+
+/* count keys < x in a short run */
+static inline int btree_run_count_lt_i32(const btree_key_i32 *k, int n,
+                                         int32_t x) {
+#if BTREE_SEARCH_X86
+  if (n >= 8 && btree_cpu_avx2()) return btree_avx2_count_lt_i32(k, n, x);
+  return btree_sse2_count_lt_i32(k, n, x);
+#else
+  return btree_scalar_count_lt_i32(k, n, x);
+#endif
+}
+
+static inline int btree_run_count_lt_i64(const btree_key_i64 *k, int n,
+                                         int64_t x) {
+#if BTREE_SEARCH_X86
+  /* no 64-bit compare before SSE4.2, so the fallback is scalar */
+  if (n >= 4 && btree_cpu_avx2()) return btree_avx2_count_lt_i64(k, n, x);
+#endif
+  return btree_scalar_count_lt_i64(k, n, x);
+}
+
+/* signed kernels. btree_narrow_i* is the branchless binary search: it
+ * returns the start of the run of at most BTREE_SEARCH_SPAN keys that
+ * holds the answer and leaves the run's length in *n. keys <= x are the
+ * keys < x+1, except at the type max */
+#define BTREE_SEARCH_SIGNED_(bits)                                             \
+  static inline int btree_narrow_i##bits(const btree_key_i##bits *k, int *n,   \
+                                         int##bits##_t x) {                    \
+    int base = 0, len = *n;                                                    \
+    while (len > BTREE_SEARCH_SPAN) {                                          \
+      int half = len / 2;                                                      \
+      base += (k[base + half - 1] < x) ? half : 0;                             \
+      len -= half;                                                             \
+    }                                                                          \
+    *n = len;                                                                  \
+    return base;                                                               \
+  }                                                                            \
+                                                                               \
+  static inline int btree_count_lt_i##bits(const void *keys, int n,            \
+                                           const void *key) {                  \
+    const btree_key_i##bits *k    = keys;                                      \
+    int##bits##_t            x    = *(const btree_key_i##bits *)key;           \
+    int                      base = btree_narrow_i##bits(k, &n, x);            \
+    return base + btree_run_count_lt_i##bits(k + base, n, x);                  \
+  }                                                                            \
+                                                                               \
+  static inline int btree_count_le_i##bits(const void *keys, int n,            \
+                                           const void *key) {                  \
+    int##bits##_t x = *(const btree_key_i##bits *)key;                         \
+    if (x == INT##bits##_MAX) return n;                                        \
+    x++;                                                                       \
+    return btree_count_lt_i##bits(keys, n, &x);                                \
+  }
+
+BTREE_SEARCH_SIGNED_(32)
+BTREE_SEARCH_SIGNED_(64)
+
+/* unsigned keys: plain comparisons are cheap and branchless enough, the
+ * vector path would need a sign flip of every key */
+#define BTREE_SEARCH_UNSIGNED_(bits)                                           \
+  static inline int btree_count_le_u##bits(const void *keys, int n,            \
+                                           const void *key) {                  \
+    const btree_key_u##bits *k = keys;                                         \
+    uint##bits##_t           x = *(const btree_key_u##bits *)key;              \
+    int                      c = 0;                                            \
+    for (int i = 0; i < n; ++i) c += k[i] <= x;                                \
+    return c;                                                                  \
+  }                                                                            \
+                                                                               \
+  static inline int btree_count_lt_u##bits(const void *keys, int n,            \
+                                           const void *key) {                  \
+    const btree_key_u##bits *k = keys;                                         \
+    uint##bits##_t           x = *(const btree_key_u##bits *)key;              \
+    int                      c = 0;                                            \
+    for (int i = 0; i < n; ++i) c += k[i] < x;                                 \
+    return c;                                                                  \
+  }
+
+BTREE_SEARCH_UNSIGNED_(32)
+BTREE_SEARCH_UNSIGNED_(64)
+
+/* placeholder for key types without a kernel, never called */
+static inline int btree_count_none(const void *keys, int n, const void *key) {
+  (void)keys;
+  (void)key;
+  return n;
+}
+
+// Kernel for the type of expression e, kind is le or lt.
+#define BTREE_SEARCH_KERNEL(e, kind)                                           \
+  _Generic((e),                                                                \
+      int: btree_count_##kind##_i32,                                           \
+      unsigned int: btree_count_##kind##_u32,                                  \
+      long: (sizeof(long) == 8 ? btree_count_##kind##_i64                      \
+                               : btree_count_##kind##_i32),                    \
+      unsigned long: (sizeof(long) == 8 ? btree_count_##kind##_u64             \
+                                        : btree_count_##kind##_u32),           \
+      long long: btree_count_##kind##_i64,                                     \
+      unsigned long long: btree_count_##kind##_u64,                            \
+      default: btree_count_none)
+
+// 1 if there is a kernel for key_type.
+#define BTREE_SEARCH_HAS_KERNEL(key_type)                                      \
+  _Generic(*(key_type *)0,                                                     \
+      int: 1,                                                                  \
+      unsigned int: 1,                                                         \
+      long: 1,                                                                 \
+      unsigned long: 1,                                                        \
+      long long: 1,                                                            \
+      unsigned long long: 1,                                                   \
+      default: 0)
@@ -0,0 +1,413 @@
+#pragma once
+
+/* pwrite, ftruncate and mmap are POSIX: strict ISO modes (-std=c17) hide
+ * them unless asked for before the first system header */
+#if defined(__STRICT_ANSI__) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "structures/bplustree/bplustree.h"
+
+// On-disk snapshot of a B+ tree, written by name##_snapshot_write and
+// mapped read-only by name##_snapshot_open. DEFINE_BTREE_SNAPSHOT(name)
+// adds these functions to a tree defined by DEFINE_BTREE*; trees without
+// it stay free of the POSIX file and mapping calls. In strict ISO mode,
+// include this header before any system header (or define
+// _POSIX_C_SOURCE) so that those calls are declared.
+//
+// The file is a header followed by 64-byte aligned sections. It stores
+// a static, fully packed copy of the tree rather than the live tree's
+// nodes. Every level is an array of keys with no pointers at all:
+//
+//   level 0 .. height-2 - internal levels, root first. Node j of a level
+//                         owns MAX_KEYS key slots starting at j * MAX_KEYS,
+//                         and its children are nodes j * ORDER + s of the
+//                         level below
+//   level height-1      - every key in order. Leaf j is keys
+//                         [j * LEAF_KEYS, (j+1) * LEAF_KEYS)
+//   entries             - the entries by value, in the same order
+//
+// Every node is full except the last one of each level, so node sizes
+// follow from the entry count and the header only needs section offsets.
+// entry_type must be plain data: it is copied byte for byte and read back
+// in place. The header checksum and the body checksum catch torn and
+// corrupted files. Files are only read back by the same instantiation
+// (key and entry size, ORDER, LEAF_KEYS) on a machine of the same byte
+// order.
+
+#define BTREE_SNAP_MAGIC      "BPTSNAP"
+#define BTREE_SNAP_VERSION    1u
+#define BTREE_SNAP_BYTE_ORDER 0x01020304u
+#define BTREE_SNAP_ALIGN      64
+#define BTREE_SNAP_MAX_LEVELS 32
+
+typedef struct btree_snap_header {
+  char     magic[8]; /* BTREE_SNAP_MAGIC */
+  uint32_t version;
+  uint32_t byte_order; /* BTREE_SNAP_BYTE_ORDER in the writer's order */
+  uint32_t key_size;
+  uint32_t entry_size;
+  uint32_t order;
+  uint32_t leaf_keys;
+  uint32_t height; /* levels including the leaf keys, 0 when empty */
+  uint32_t reserved;
+  uint64_t entries;
+  uint64_t file_bytes;
+  uint64_t level_off[BTREE_SNAP_MAX_LEVELS]; /* level 0 is the root */
+  uint64_t entries_off;
+  uint64_t spare[6]; /* zero, pads the header to BTREE_SNAP_ALIGN */
+  uint64_t body_checksum;   /* of bytes [sizeof(header), file_bytes) */
+  uint64_t header_checksum; /* of the header up to this field */
+} btree_snap_header;
+
+_Static_assert(sizeof(btree_snap_header) % BTREE_SNAP_ALIGN == 0,
+               "snapshot header must keep sections aligned");
+
+/* checksum of whole 64-bit words: a multiply-xor chain with a final mix */
+static inline uint64_t btree_snap_hash(uint64_t h, const void *p,
+                                       size_t bytes) {
+  const unsigned char *b = p;
+  for (size_t i = 0; i + 8 <= bytes; i += 8) {
+    uint64_t w;
+    memcpy(&w, b + i, 8);
+    h = (h ^ w) * 0x9E3779B97F4A7C15ULL;
+    h ^= h >> 29;
+  }
+  return h;
+}
+
+static inline uint64_t btree_snap_hash_init(void) {
+  return 0xCBF29CE484222325ULL;
+}
+
+static inline uint64_t btree_snap_hash_final(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDULL;
+  h ^= h >> 33;
+  return h;
+}
+
+static inline size_t btree_snap_align(size_t n) {
+  return (n + BTREE_SNAP_ALIGN - 1) & ~(size_t)(BTREE_SNAP_ALIGN - 1);
+}
+
+// Buffered sequential writer that checksums what it writes.
+#define BTREE_SNAP_BUF_BYTES (64 * 1024)
+
+typedef struct btree_snap_writer {
+  int      fd;
+  off_t    off; /* file offset of buf[0] */
+  uint64_t hash;
+  size_t   len;
+  int      err; /* errno of the first failed write, 0 if none */
+  _Alignas(8) unsigned char buf[BTREE_SNAP_BUF_BYTES];
+} btree_snap_writer;
+
+/* write all of buf at off, retrying short writes */
+static inline int btree_snap_pwrite(int fd, const void *buf, size_t bytes,
+                                    off_t off) {
+  const char *p = buf;
+  while (bytes) {
+    ssize_t w = pwrite(fd, p, bytes, off);
+    if (w < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    p += w;
+    off += w;
+    bytes -= (size_t)w;
+  }
+  return 0;
+}
+
+static inline void btree_snap_flush(btree_snap_writer *w) {
+  if (!w->len) return;
+  /* len is a multiple of 8: buffers only fill in whole words and sections
+   * end on BTREE_SNAP_ALIGN */
+  w->hash = btree_snap_hash(w->hash, w->buf, w->len);
+  if (!w->err && btree_snap_pwrite(w->fd, w->buf, w->len, w->off) != 0)
+    w->err = errno;
+  w->off += (off_t)w->len;
+  w->len = 0;
+}
+
+static inline void btree_snap_put(btree_snap_writer *w, const void *p,
+                                  size_t bytes) {
+  const unsigned char *b = p;
+  while (bytes) {
+    size_t room = BTREE_SNAP_BUF_BYTES - w->len;
+    size_t n    = bytes < room ? bytes : room;
+    memcpy(w->buf + w->len, b, n);
+    w->len += n;
+    b += n;
+    bytes -= n;
+    if (w->len == BTREE_SNAP_BUF_BYTES) btree_snap_flush(w);
+  }
+}
+
+/* zero-fill up to the next BTREE_SNAP_ALIGN boundary */
+static inline void btree_snap_pad(btree_snap_writer *w) {
+  static const unsigned char zeros[BTREE_SNAP_ALIGN];
+  size_t pos = (size_t)w->off + w->len;
+  btree_snap_put(w, zeros, btree_snap_align(pos) - pos);
+}
+
+/* nodes on each level of a packed tree over n keys, root first. returns
+ * the number of levels (0 for n == 0), -1 past BTREE_SNAP_MAX_LEVELS */
+static inline int btree_snap_levels(uint64_t n, int order, int leaf_keys,
+                                    uint64_t *count) {
+  uint64_t c[BTREE_SNAP_MAX_LEVELS];
+  int      h = 0;
+  if (n == 0) return 0;
+  c[h++] = (n + leaf_keys - 1) / leaf_keys;
+  while (c[h - 1] > 1 && h < BTREE_SNAP_MAX_LEVELS) {
+    c[h] = (c[h - 1] + order - 1) / order;
+    h++;
+  }
+  if (c[h - 1] > 1) return -1;
+  for (int l = 0; l < h; ++l) count[l] = c[h - 1 - l];
+  return h;
+}
+
+// Snapshot functions for tree name, after its DEFINE_BTREE*:
+//   name##_snapshot_write(t, fd)              - write a snapshot of t
+//   name##_snapshot_open(&s, fd, verify)      - map one read-only
+//   name##_snapshot_close(&s)
+//   name##_snapshot_search(&s, key)           - entry or NULL
+//   name##_snapshot_bound(&s, key, upper)     - lower/upper bound index
+//   name##_snapshot_range(&s, lo, hi, &first) - entries with lo <= key < hi
+#define DEFINE_BTREE_SNAPSHOT(name)                                            \
+  DEFINE_BTREE_SNAPSHOT_(name, name##_key_t, name##_entry_t)
+
+#define DEFINE_BTREE_SNAPSHOT_(name, key_type, entry_type)                     \
+  /* read-only view of a snapshot file */                                      \
+  typedef struct name##_snapshot {                                             \
+    const btree_snap_header *hdr; /* start of the mapping */                   \
+    size_t                   bytes;                                            \
+    size_t                   n; /* entries */                                  \
+    int                      height;                                           \
+    const key_type          *level[BTREE_SNAP_MAX_LEVELS];                     \
+    uint64_t                 count[BTREE_SNAP_MAX_LEVELS]; /* nodes */         \
+    const entry_type        *entries;                                          \
+  } name##_snapshot;                                                           \
+                                                                               \
+  /* write a packed snapshot of t to fd (a regular file, overwritten from      \
+   * offset 0). entry_type must be plain data. 0 on success, -1 with errno     \
+   * set on failure */                                                         \
+  static inline int name##_snapshot_write(name *t, int fd) {                   \
+    size_t n = 0;                                                              \
+    for (list_head *p = t->leaves.next; p != &t->leaves; p = p->next)          \
+      n += container_of(p, name##_leaf, leaf_link)->hdr.nkeys;                 \
+    uint64_t count[BTREE_SNAP_MAX_LEVELS];                                     \
+    int h = btree_snap_levels(n, name##_ORDER, name##_LEAF_KEYS, count);       \
+    if (h < 0) {                                                               \
+      errno = EFBIG;                                                           \
+      return -1;                                                               \
+    }                                                                          \
+    /* separators are first keys of subtrees, so keep all keys at hand */      \
+    key_type          *keys = malloc(n ? n * sizeof(key_type) : 1);            \
+    btree_snap_writer *w    = malloc(sizeof(*w));                              \
+    if (!keys || !w) {                                                         \
+      free(keys);                                                              \
+      free(w);                                                                 \
+      errno = ENOMEM;                                                          \
+      return -1;                                                               \
+    }                                                                          \
+    size_t k = 0;                                                              \
+    for (list_head *p = t->leaves.next; p != &t->leaves; p = p->next) {        \
+      name##_leaf *leaf = container_of(p, name##_leaf, leaf_link);             \
+      memcpy(&keys[k], leaf->keys, leaf->hdr.nkeys * sizeof(key_type));        \
+      k += leaf->hdr.nkeys;                                                    \
+    }                                                                          \
+                                                                               \
+    btree_snap_header hdr;                                                     \
+    memset(&hdr, 0, sizeof(hdr));                                              \
+    memcpy(hdr.magic, BTREE_SNAP_MAGIC, sizeof(hdr.magic));                    \
+    hdr.version    = BTREE_SNAP_VERSION;                                       \
+    hdr.byte_order = BTREE_SNAP_BYTE_ORDER;                                    \
+    hdr.key_size   = sizeof(key_type);                                         \
+    hdr.entry_size = sizeof(entry_type);                                       \
+    hdr.order      = name##_ORDER;                                             \
+    hdr.leaf_keys  = name##_LEAF_KEYS;                                         \
+    hdr.height     = (uint32_t)h;                                              \
+    hdr.entries    = n;                                                        \
+    w->fd          = fd;                                                       \
+    w->off         = sizeof(hdr);                                              \
+    w->hash        = btree_snap_hash_init();                                   \
+    w->len         = 0;                                                        \
+    w->err         = 0;                                                        \
+                                                                               \
+    for (int l = 0; l + 1 < h; ++l) {                                          \
+      /* leaves under each node of level l+1 */                                \
+      uint64_t span = 1;                                                       \
+      for (int m = l + 1; m + 1 < h; ++m) span *= name##_ORDER;                \
+      hdr.level_off[l] = (uint64_t)w->off + w->len;                            \
+      for (uint64_t j = 0; j < count[l]; ++j) {                                \
+        key_type slots[name##_MAX_KEYS];                                       \
+        uint64_t first = j * name##_ORDER;                                     \
+        uint64_t kids  = count[l + 1] - first;                                 \
+        int      nk    = (int)(kids < name##_ORDER ? kids : name##_ORDER) - 1; \
+        memset(slots, 0, sizeof(slots));                                       \
+        for (int s = 1; s <= nk; ++s)                                          \
+          slots[s - 1] = keys[(first + s) * span * name##_LEAF_KEYS];          \
+        btree_snap_put(w, slots, sizeof(slots));                               \
+      }                                                                        \
+      btree_snap_pad(w);                                                       \
+    }                                                                          \
+    if (h > 0) {                                                               \
+      hdr.level_off[h - 1] = (uint64_t)w->off + w->len;                        \
+      btree_snap_put(w, keys, n * sizeof(key_type));                           \
+      btree_snap_pad(w);                                                       \
+    }                                                                          \
+    hdr.entries_off = (uint64_t)w->off + w->len;                               \
+    for (list_head *p = t->leaves.next; p != &t->leaves; p = p->next) {        \
+      name##_leaf *leaf = container_of(p, name##_leaf, leaf_link);             \
+      for (int i = 0; i < leaf->hdr.nkeys; ++i)                                \
+        btree_snap_put(w, leaf->leaf_entries[i], sizeof(entry_type));          \
+    }                                                                          \
+    btree_snap_pad(w);                                                         \
+    btree_snap_flush(w);                                                       \
+                                                                               \
+    hdr.file_bytes      = (uint64_t)w->off;                                    \
+    hdr.body_checksum   = btree_snap_hash_final(w->hash);                      \
+    hdr.header_checksum = btree_snap_hash_final(btree_snap_hash(               \
+        btree_snap_hash_init(), &hdr,                                          \
+        offsetof(btree_snap_header, header_checksum)));                        \
+    int err = w->err;                                                          \
+    free(keys);                                                                \
+    free(w);                                                                   \
+    if (!err && btree_snap_pwrite(fd, &hdr, sizeof(hdr), 0) != 0) err = errno; \
+    if (!err && ftruncate(fd, (off_t)hdr.file_bytes) != 0) err = errno;        \
+    if (err) {                                                                 \
+      errno = err;                                                             \
+      return -1;                                                               \
+    }                                                                          \
+    return 0;                                                                  \
+  }                                                                            \
+                                                                               \
+  /* map the snapshot in fd read-only. the header is always checked, the       \
+   * body checksum only with verify (it reads the whole file). 0 on            \
+   * success; -1 with errno EINVAL (not a snapshot of this instantiation),     \
+   * EBADMSG (checksum mismatch) or the mmap error */                          \
+  static inline int name##_snapshot_open(name##_snapshot *s, int fd,           \
+                                         bool verify) {                        \
+    struct stat st;                                                            \
+    if (fstat(fd, &st) != 0) return -1;                                        \
+    size_t bytes = (size_t)st.st_size;                                         \
+    if (bytes < sizeof(btree_snap_header)) {                                   \
+      errno = EINVAL;                                                          \
+      return -1;                                                               \
+    }                                                                          \
+    void *map = mmap(NULL, bytes, PROT_READ, MAP_SHARED, fd, 0);               \
+    if (map == MAP_FAILED) return -1;                                          \
+    const btree_snap_header *hdr = map;                                        \
+    int                      err = 0;                                          \
+    int h = btree_snap_levels(hdr->entries, name##_ORDER, name##_LEAF_KEYS,    \
+                              s->count);                                       \
+    if (memcmp(hdr->magic, BTREE_SNAP_MAGIC, sizeof(hdr->magic)) ||            \
+        hdr->version != BTREE_SNAP_VERSION ||                                  \
+        hdr->byte_order != BTREE_SNAP_BYTE_ORDER ||                            \
+        hdr->key_size != sizeof(key_type) ||                                   \
+        hdr->entry_size != sizeof(entry_type) ||                               \
+        hdr->order != name##_ORDER || hdr->leaf_keys != name##_LEAF_KEYS ||    \
+        hdr->file_bytes != bytes || h < 0 || hdr->height != (uint32_t)h)       \
+      err = EINVAL;                                                            \
+    else if (hdr->header_checksum !=                                           \
+             btree_snap_hash_final(btree_snap_hash(                            \
+                 btree_snap_hash_init(), hdr,                                  \
+                 offsetof(btree_snap_header, header_checksum))))               \
+      err = EBADMSG;                                                           \
+    /* every section has to lie inside the file */                             \
+    for (int l = 0; !err && l < h; ++l) {                                      \
+      uint64_t len = l + 1 < h ? s->count[l] * name##_MAX_KEYS : hdr->entries; \
+      if (hdr->level_off[l] % BTREE_SNAP_ALIGN ||                              \
+          hdr->level_off[l] > bytes ||                                         \
+          len > (bytes - hdr->level_off[l]) / sizeof(key_type))                \
+        err = EINVAL;                                                          \
+    }                                                                          \
+    if (!err && (hdr->entries_off % BTREE_SNAP_ALIGN ||                        \
+                 hdr->entries_off > bytes ||                                   \
+                 hdr->entries >                                                \
+                     (bytes - hdr->entries_off) / sizeof(entry_type)))         \
+      err = EINVAL;                                                            \
+    if (!err && verify) {                                                      \
+      const char *body = (const char *)map + sizeof(btree_snap_header);        \
+      uint64_t    sum  = btree_snap_hash(btree_snap_hash_init(), body,         \
+                                         bytes - sizeof(btree_snap_header));   \
+      if (btree_snap_hash_final(sum) != hdr->body_checksum) err = EBADMSG;     \
+    }                                                                          \
+    if (err) {                                                                 \
+      munmap(map, bytes);                                                      \
+      errno = err;                                                             \
+      return -1;                                                               \
+    }                                                                          \
+    s->hdr    = hdr;                                                           \
+    s->bytes  = bytes;                                                         \
+    s->n      = hdr->entries;                                                  \
+    s->height = h;                                                             \
+    for (int l = 0; l < h; ++l)                                                \
+      s->level[l] = (const key_type *)((const char *)map + hdr->level_off[l]); \
+    s->entries =                                                               \
+        (const entry_type *)((const char *)map + hdr->entries_off);            \
+    return 0;                                                                  \
+  }                                                                            \
+                                                                               \
+  static inline void name##_snapshot_close(name##_snapshot *s) {               \
+    munmap((void *)s->hdr, s->bytes);                                          \
+    s->hdr = NULL;                                                             \
+  }                                                                            \
+                                                                               \
+  /* index of the first entry with key >= key (upper: > key), s->n if none.    \
+   * internal levels are searched like a live tree, leaves are runs of the     \
+   * key array */                                                              \
+  static inline size_t name##_snapshot_bound(const name##_snapshot *s,         \
+                                             key_type key, bool upper) {       \
+    if (s->n == 0) return 0;                                                   \
+    uint64_t j = 0;                                                            \
+    for (int l = 0; l + 1 < s->height; ++l) {                                  \
+      uint64_t first = j * name##_ORDER;                                       \
+      uint64_t kids  = s->count[l + 1] - first;                                \
+      int      nk    = (int)(kids < name##_ORDER ? kids : name##_ORDER) - 1;   \
+      const key_type *k = s->level[l] + j * name##_MAX_KEYS;                   \
+      j = first + (uint64_t)(upper ? name##_count_le(k, nk, key)               \
+                                   : name##_count_lt(k, nk, key));             \
+    }                                                                          \
+    size_t first = j * name##_LEAF_KEYS;                                       \
+    size_t rest  = s->n - first;                                               \
+    int    nk    = (int)(rest < name##_LEAF_KEYS ? rest : name##_LEAF_KEYS);   \
+    const key_type *k = s->level[s->height - 1] + first;                       \
+    return first + (size_t)(upper ? name##_count_le(k, nk, key)                \
+                                  : name##_count_lt(k, nk, key));              \
+  }                                                                            \
+                                                                               \
+  /* name##_search on a snapshot: entry with key, or NULL */                   \
+  static inline const entry_type *                                             \
+  name##_snapshot_search(const name##_snapshot *s, key_type key) {             \
+    size_t i = name##_snapshot_bound(s, key, false);                           \
+    if (i < s->n && name##_cmp(s->level[s->height - 1][i], key) == 0)          \
+      return &s->entries[i];                                                   \
+    return NULL;                                                               \
+  }                                                                            \
+                                                                               \
+  /* entries with lo <= key < hi: *first points at the first of them and       \
+   * the count is returned. they are consecutive in s->entries */              \
+  static inline size_t name##_snapshot_range(const name##_snapshot *s,         \
+                                             key_type lo, key_type hi,         \
+                                             const entry_type **first) {       \
+    size_t a = name##_snapshot_bound(s, lo, false);                            \
+    size_t b = name##_snapshot_bound(s, hi, false);                            \
+    *first   = s->entries + a;                                                 \
+    return b > a ? b - a : 0;                                                  \
+  }
@@ -0,0 +1,434 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "structures/bplustree/bplustree.h"
+
+// B+ tree keyed by NUL-terminated strings, for keys with long shared
+// prefixes (URLs, paths).
+//
+// Every node records the prefix its keys share: its length, and a key that
+// has it. Each slot holds an abbreviated key, the next 8 bytes after that
+// prefix packed big-endian into a uint64_t. A search compares the prefix
+// once per node. Inside the node it finds its slot with integer compares
+// on the abbreviations, using the search.h kernels. Full string compares
+// are only needed between keys whose 8 bytes after the prefix are equal.
+//
+// Internal nodes hold truncated separators: the shortest prefix of the
+// right node's first key that still sorts after the left node's last key.
+// They are copied into a pool owned by the tree. Leaves point at the
+// entries and read full keys through them.
+//
+// DEFINE_BTREE_STR(name, entry_type, key_member, NODE_BYTES) gives
+//   name##_init / name##_clear / name##_destroy
+//   name##_insert(t, e)        - 0, or -1 out of memory; equal keys are kept
+//                                in insertion order
+//   name##_search(t, key)      - entry or NULL
+//   name##_lower_bound(t, key) - cursor on the first entry with key >= key
+//   name##_cursor_valid / name##_cursor_entry / name##_cursor_next
+//   name##_iterate(t, cb, ctx)
+// key_member must be a const char * that stays valid and unchanged while
+// its entry is in the tree.
+
+// Bump allocator for separator strings, freed all at once.
+#define BTREE_STRPOOL_BLOCK (64 * 1024)
+
+typedef struct btree_strpool_block {
+  struct btree_strpool_block *next;
+  size_t                      used, cap;
+  char                        data[];
+} btree_strpool_block;
+
+typedef struct btree_strpool {
+  btree_strpool_block *head;
+  size_t               bytes; /* obtained from malloc */
+} btree_strpool;
+
+static inline void btree_strpool_init(btree_strpool *p) {
+  p->head  = NULL;
+  p->bytes = 0;
+}
+
+/* copy of the first len bytes of s, NUL-terminated */
+static inline const char *btree_strpool_dup(btree_strpool *p, const char *s,
+                                            size_t len) {
+  btree_strpool_block *b = p->head;
+  if (!b || b->cap - b->used < len + 1) {
+    size_t cap = len + 1 > BTREE_STRPOOL_BLOCK ? len + 1 : BTREE_STRPOOL_BLOCK;
+    b          = malloc(sizeof(*b) + cap);
+    if (!b) return NULL;
+    b->next = p->head;
+    b->used = 0;
+    b->cap  = cap;
+    p->head = b;
+    p->bytes += sizeof(*b) + cap;
+  }
+  char *d = b->data + b->used;
+  memcpy(d, s, len);
+  d[len] = '\0';
+  b->used += len + 1;
+  return d;
+}
+
+static inline void btree_strpool_release(btree_strpool *p) {
+  while (p->head) {
+    btree_strpool_block *b = p->head;
+    p->head                = b->next;
+    free(b);
+  }
+  p->bytes = 0;
+}
+
+/* length of the common prefix of a and b */
+static inline int btree_str_lcp(const char *a, const char *b) {
+  int i = 0;
+  while (a[i] && a[i] == b[i]) i++;
+  return i;
+}
+
+/* bytes [off, off+8) of s big-endian, zero past the end. s has at least
+ * off bytes before its terminator */
+static inline uint64_t btree_str_abbrev(const char *s, int off) {
+  uint64_t v = 0;
+  int      i = 0;
+  s += off;
+  for (; i < 8 && s[i]; ++i) v = v << 8 | (unsigned char)s[i];
+  return i ? v << (8 * (8 - i)) : 0;
+}
+
+/* true if the abbreviation holds the key's terminator */
+static inline bool btree_str_abbrev_ends(uint64_t v) {
+  return (v & 0xFF) == 0;
+}
+
+// Node sizing: a header, then per slot an 8-byte abbreviation and a
+// pointer; internal nodes have one more child pointer, leaves a list_head.
+#define BTREE_STR_HDR_BYTES 24
+#define BTREE_STR_ORDER_FOR_BYTES(bytes)                                       \
+  (((bytes) - BTREE_STR_HDR_BYTES + 16) / 24)
+#define BTREE_STR_LEAF_KEYS_FOR_BYTES(bytes)                                   \
+  (((bytes) - BTREE_STR_HDR_BYTES - sizeof(list_head)) / 16)
+
+#define DEFINE_BTREE_STR(name, entry_type, key_member, NODE_BYTES)             \
+  enum {                                                                       \
+    name##_ORDER     = BTREE_STR_ORDER_FOR_BYTES(NODE_BYTES),                  \
+    name##_MAX_KEYS  = name##_ORDER - 1,                                       \
+    name##_LEAF_KEYS = BTREE_STR_LEAF_KEYS_FOR_BYTES(NODE_BYTES)               \
+  };                                                                           \
+  _Static_assert(name##_ORDER >= 3 && name##_LEAF_KEYS >= 2,                   \
+                 #name ": NODE_BYTES too small");                              \
+                                                                               \
+  /* header shared by both node layouts */                                     \
+  typedef struct name##_node {                                                 \
+    bool        is_leaf;                                                       \
+    int         nkeys;                                                         \
+    int         prefix_len; /* bytes every key in the node shares */           \
+    const char *prefix;     /* a key that has them */                          \
+  } name##_node;                                                               \
+                                                                               \
+  typedef struct name##_inner {                                                \
+    name##_node  hdr;                                                          \
+    uint64_t     abbrev[name##_MAX_KEYS];                                      \
+    const char  *seps[name##_MAX_KEYS]; /* truncated, in the tree's pool */    \
+    name##_node *children[name##_ORDER];                                       \
+  } name##_inner;                                                              \
+                                                                               \
+  typedef struct name##_leaf {                                                 \
+    name##_node hdr;                                                           \
+    uint64_t    abbrev[name##_LEAF_KEYS];                                      \
+    entry_type *leaf_entries[name##_LEAF_KEYS];                                \
+    list_head   leaf_link;                                                     \
+  } name##_leaf;                                                               \
+                                                                               \
+  _Static_assert(sizeof(name##_inner) <= (NODE_BYTES) &&                       \
+                     sizeof(name##_leaf) <= (NODE_BYTES),                      \
+                 #name ": nodes do not fit in " #NODE_BYTES " bytes");         \
+                                                                               \
+  typedef struct name {                                                        \
+    name##_node  *root;                                                        \
+    list_head     leaves;                                                      \
+    btree_strpool seps;                                                        \
+  } name;                                                                      \
+                                                                               \
+  typedef struct name##_cursor {                                               \
+    name##_leaf *leaf;                                                         \
+    int          slot;                                                         \
+    list_head   *head;                                                         \
+  } name##_cursor;                                                             \
+                                                                               \
+  static inline name##_inner *name##_as_inner(name##_node *n) {                \
+    return (name##_inner *)n;                                                  \
+  }                                                                            \
+                                                                               \
+  static inline name##_leaf *name##_as_leaf(name##_node *n) {                  \
+    return (name##_leaf *)n;                                                   \
+  }                                                                            \
+                                                                               \
+  static inline void name##_init(name *t) {                                    \
+    t->root = NULL;                                                            \
+    INIT_LIST_HEAD(&t->leaves);                                                \
+    btree_strpool_init(&t->seps);                                              \
+  }                                                                            \
+                                                                               \
+  static inline void name##_free_subtree(name##_node *n) {                     \
+    if (!n->is_leaf)                                                           \
+      for (int i = 0; i <= n->nkeys; ++i)                                      \
+        name##_free_subtree(name##_as_inner(n)->children[i]);                  \
+    free(n);                                                                   \
+  }                                                                            \
+                                                                               \
+  static inline void name##_clear(name *t) {                                   \
+    if (t->root) name##_free_subtree(t->root);                                 \
+    t->root = NULL;                                                            \
+    INIT_LIST_HEAD(&t->leaves);                                                \
+    btree_strpool_release(&t->seps);                                           \
+  }                                                                            \
+                                                                               \
+  static inline void name##_destroy(name *t) { name##_clear(t); }              \
+                                                                               \
+  /* full key in slot i */                                                     \
+  static inline const char *name##_key_at(const name##_node *n, int i) {       \
+    return n->is_leaf ? ((const name##_leaf *)n)->leaf_entries[i]->key_member  \
+                      : ((const name##_inner *)n)->seps[i];                    \
+  }                                                                            \
+                                                                               \
+  static inline uint64_t *name##_abbrevs(name##_node *n) {                     \
+    return n->is_leaf ? name##_as_leaf(n)->abbrev                              \
+                      : name##_as_inner(n)->abbrev;                            \
+  }                                                                            \
+                                                                               \
+  /* recompute the shared prefix and every abbreviation of n */                \
+  static inline void name##_reprefix(name##_node *n) {                         \
+    uint64_t *ab = name##_abbrevs(n);                                          \
+    int       k  = n->nkeys;                                                   \
+    n->prefix     = k ? name##_key_at(n, 0) : NULL;                            \
+    n->prefix_len = k ? btree_str_lcp(n->prefix, name##_key_at(n, k - 1)) : 0; \
+    for (int i = 0; i < k; ++i)                                                \
+      ab[i] = btree_str_abbrev(name##_key_at(n, i), n->prefix_len);            \
+  }                                                                            \
+                                                                               \
+  /* after slot pos of n was filled with k: keep the prefix if k shares it,    \
+   * otherwise shrink it and redo the node */                                  \
+  static inline void name##_slot_added(name##_node *n, int pos,                \
+                                       const char *k) {                        \
+    if (n->nkeys == 1 || (pos > 0 && pos < n->nkeys - 1) ||                    \
+        strncmp(k, n->prefix, n->prefix_len) == 0) {                           \
+      if (n->nkeys == 1) {                                                     \
+        n->prefix     = k;                                                     \
+        n->prefix_len = (int)strlen(k);                                        \
+      }                                                                        \
+      name##_abbrevs(n)[pos] = btree_str_abbrev(k, n->prefix_len);             \
+      if (pos == 0) n->prefix = k;                                             \
+      return;                                                                  \
+    }                                                                          \
+    name##_reprefix(n);                                                        \
+  }                                                                            \
+                                                                               \
+  /* number of keys in n <= key (upper) or < key (!upper) */                   \
+  static inline int name##_count(const name##_node *n, const char *key,        \
+                                 bool upper) {                                 \
+    int k = n->nkeys, p = n->prefix_len;                                       \
+    if (k == 0) return 0;                                                      \
+    if (p) {                                                                   \
+      int c = strncmp(key, n->prefix, p);                                      \
+      if (c) return c < 0 ? 0 : k;                                             \
+    }                                                                          \
+    const uint64_t *ab = n->is_leaf ? ((const name##_leaf *)n)->abbrev         \
+                                    : ((const name##_inner *)n)->abbrev;       \
+    uint64_t        ka = btree_str_abbrev(key, p);                             \
+    int             lt = btree_count_lt_u64(ab, k, &ka);                       \
+    int             le = btree_count_le_u64(ab, k, &ka);                       \
+    if (lt == le || btree_str_abbrev_ends(ka)) return upper ? le : lt;         \
+    /* equal abbreviations: settle the tie on the rest of the strings */       \
+    int i = lt;                                                                \
+    while (i < le) {                                                           \
+      int c = strcmp(key + p + 8, name##_key_at(n, i) + p + 8);                \
+      if (upper ? c < 0 : c <= 0) break;                                       \
+      ++i;                                                                     \
+    }                                                                          \
+    return i;                                                                  \
+  }                                                                            \
+                                                                               \
+  static inline name##_leaf *name##_find_leaf(name *t, const char *key,        \
+                                              bool upper) {                    \
+    name##_node *n = t->root;                                                  \
+    if (!n) return NULL;                                                       \
+    while (!n->is_leaf)                                                        \
+      n = name##_as_inner(n)->children[name##_count(n, key, upper)];           \
+    return name##_as_leaf(n);                                                  \
+  }                                                                            \
+                                                                               \
+  static inline entry_type *name##_search(name *t, const char *key) {          \
+    name##_leaf *leaf = name##_find_leaf(t, key, true);                        \
+    if (!leaf) return NULL;                                                    \
+    int i = name##_count(&leaf->hdr, key, false);                              \
+    if (i < leaf->hdr.nkeys &&                                                 \
+        strcmp(leaf->leaf_entries[i]->key_member, key) == 0)                   \
+      return leaf->leaf_entries[i];                                            \
+    return NULL;                                                               \
+  }                                                                            \
+                                                                               \
+  /* put e at slot pos of a leaf that is not full */                           \
+  static inline void name##_leaf_put(name##_leaf *l, int pos, entry_type *e) { \
+    int n = l->hdr.nkeys;                                                      \
+    memmove(&l->abbrev[pos + 1], &l->abbrev[pos], (n - pos) * 8);              \
+    memmove(&l->leaf_entries[pos + 1], &l->leaf_entries[pos],                  \
+            (n - pos) * sizeof(entry_type *));                                 \
+    l->leaf_entries[pos] = e;                                                  \
+    l->hdr.nkeys++;                                                            \
+    name##_slot_added(&l->hdr, pos, e->key_member);                            \
+  }                                                                            \
+                                                                               \
+  /* put sep and the child right of it at slot pos of a non-full node */       \
+  static inline void name##_inner_put(name##_inner *in, int pos,               \
+                                      const char *sep, name##_node *right) {   \
+    int n = in->hdr.nkeys;                                                     \
+    memmove(&in->abbrev[pos + 1], &in->abbrev[pos], (n - pos) * 8);            \
+    memmove(&in->seps[pos + 1], &in->seps[pos], (n - pos) * sizeof(sep));      \
+    memmove(&in->children[pos + 2], &in->children[pos + 1],                    \
+            (n - pos) * sizeof(right));                                        \
+    in->seps[pos]         = sep;                                               \
+    in->children[pos + 1] = right;                                             \
+    in->hdr.nkeys++;                                                           \
+    name##_slot_added(&in->hdr, pos, sep);                                     \
+  }                                                                            \
+                                                                               \
+  /* hang right (first key above sep) next to child idx[d] of path[d], for     \
+   * d = depth-1 upwards, splitting full parents */                            \
+  static inline int name##_insert_up(name *t, name##_inner **path, int *idx,   \
+                                     int depth, name##_node *left,             \
+                                     const char *sep, name##_node *right) {    \
+    while (depth > 0) {                                                        \
+      name##_inner *p   = path[--depth];                                       \
+      int           pos = idx[depth];                                          \
+      int           n   = p->hdr.nkeys;                                        \
+      if (n < name##_MAX_KEYS) {                                               \
+        name##_inner_put(p, pos, sep, right);                                  \
+        return 0;                                                              \
+      }                                                                        \
+      name##_inner *r = malloc(sizeof(*r));                                    \
+      if (!r) return -1;                                                       \
+      const char  *seps[name##_MAX_KEYS + 1];                                  \
+      name##_node *kids[name##_ORDER + 1];                                     \
+      memcpy(seps, p->seps, pos * sizeof(sep));                                \
+      memcpy(kids, p->children, (pos + 1) * sizeof(right));                    \
+      seps[pos]     = sep;                                                     \
+      kids[pos + 1] = right;                                                   \
+      memcpy(&seps[pos + 1], &p->seps[pos], (n - pos) * sizeof(sep));          \
+      memcpy(&kids[pos + 2], &p->children[pos + 1],                            \
+             (n - pos) * sizeof(right));                                       \
+      int mid = (n + 1) / 2; /* seps[mid] moves up */                          \
+      memcpy(p->seps, seps, mid * sizeof(sep));                                \
+      memcpy(p->children, kids, (mid + 1) * sizeof(right));                    \
+      p->hdr.nkeys = mid;                                                      \
+      r->hdr       = (name##_node){.is_leaf = false, .nkeys = n - mid};        \
+      memcpy(r->seps, &seps[mid + 1], (n - mid) * sizeof(sep));                \
+      memcpy(r->children, &kids[mid + 1], (n - mid + 1) * sizeof(right));      \
+      name##_reprefix(&p->hdr);                                                \
+      name##_reprefix(&r->hdr);                                                \
+      sep   = seps[mid];                                                       \
+      left  = &p->hdr;                                                         \
+      right = &r->hdr;                                                         \
+    }                                                                          \
+    name##_inner *root = malloc(sizeof(*root));                                \
+    if (!root) return -1;                                                      \
+    root->hdr         = (name##_node){.is_leaf = false, .nkeys = 1};           \
+    root->seps[0]     = sep;                                                   \
+    root->children[0] = left;                                                  \
+    root->children[1] = right;                                                 \
+    name##_reprefix(&root->hdr);                                               \
+    t->root = &root->hdr;                                                      \
+    return 0;                                                                  \
+  }                                                                            \
+                                                                               \
+  static inline int name##_insert(name *t, entry_type *e) {                    \
+    const char *key = e->key_member;                                           \
+    if (!t->root) {                                                            \
+      name##_leaf *r = malloc(sizeof(*r));                                     \
+      if (!r) return -1;                                                       \
+      r->hdr = (name##_node){.is_leaf = true};                                 \
+      list_add_tail(&r->leaf_link, &t->leaves);                                \
+      t->root = &r->hdr;                                                       \
+    }                                                                          \
+    name##_inner *path[BTREE_MAX_DEPTH];                                       \
+    int           idx[BTREE_MAX_DEPTH];                                        \
+    int           depth = 0;                                                   \
+    name##_node  *n     = t->root;                                             \
+    while (!n->is_leaf) {                                                      \
+      path[depth] = name##_as_inner(n);                                        \
+      idx[depth]  = name##_count(n, key, true);                                \
+      n           = path[depth]->children[idx[depth]];                         \
+      depth++;                                                                 \
+    }                                                                          \
+    name##_leaf *leaf = name##_as_leaf(n);                                     \
+    int          pos  = name##_count(n, key, true);                            \
+    if (leaf->hdr.nkeys < name##_LEAF_KEYS) {                                  \
+      name##_leaf_put(leaf, pos, e);                                           \
+      return 0;                                                                \
+    }                                                                          \
+    name##_leaf *right = malloc(sizeof(*right));                               \
+    if (!right) return -1;                                                     \
+    int mid     = (name##_LEAF_KEYS + 1) / 2;                                  \
+    right->hdr  = (name##_node){.is_leaf = true,                               \
+                                .nkeys   = name##_LEAF_KEYS - mid};            \
+    memcpy(right->leaf_entries, &leaf->leaf_entries[mid],                      \
+           (name##_LEAF_KEYS - mid) * sizeof(entry_type *));                   \
+    leaf->hdr.nkeys = mid;                                                     \
+    list_add_tail(&right->leaf_link, leaf->leaf_link.next);                    \
+    name##_reprefix(&leaf->hdr);                                               \
+    name##_reprefix(&right->hdr);                                              \
+    if (pos >= mid)                                                            \
+      name##_leaf_put(right, pos - mid, e);                                    \
+    else                                                                       \
+      name##_leaf_put(leaf, pos, e);                                           \
+    /* shortest prefix of right's first key that sorts after left's last */    \
+    const char *a   = leaf->leaf_entries[leaf->hdr.nkeys - 1]->key_member;     \
+    const char *b   = right->leaf_entries[0]->key_member;                      \
+    size_t      len = (size_t)btree_str_lcp(a, b);                             \
+    if (b[len]) len++;                                                         \
+    const char *sep = btree_strpool_dup(&t->seps, b, len);                     \
+    if (!sep) return -1;                                                       \
+    return name##_insert_up(t, path, idx, depth, &leaf->hdr, sep,              \
+                            &right->hdr);                                      \
+  }                                                                            \
+                                                                               \
+  static inline void name##_iterate(name *t,                                   \
+                                    void (*cb)(entry_type *, void *),          \
+                                    void *ctx) {                               \
+    for (list_head *p = t->leaves.next; p != &t->leaves; p = p->next) {        \
+      name##_leaf *leaf = container_of(p, name##_leaf, leaf_link);             \
+      for (int i = 0; i < leaf->hdr.nkeys; ++i)                                \
+        cb(leaf->leaf_entries[i], ctx);                                        \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  static inline bool name##_cursor_valid(const name##_cursor *c) {             \
+    return c->leaf != NULL;                                                    \
+  }                                                                            \
+                                                                               \
+  static inline entry_type *name##_cursor_entry(const name##_cursor *c) {      \
+    return c->leaf->leaf_entries[c->slot];                                     \
+  }                                                                            \
+                                                                               \
+  /* step to the next entry, or to the end */                                  \
+  static inline void name##_cursor_next(name##_cursor *c) {                    \
+    if (++c->slot < c->leaf->hdr.nkeys) return;                                \
+    list_head *p = c->leaf->leaf_link.next;                                    \
+    c->slot      = 0;                                                          \
+    c->leaf = p == c->head ? NULL : container_of(p, name##_leaf, leaf_link);   \
+  }                                                                            \
+                                                                               \
+  /* cursor on the first entry with key >= key */                              \
+  static inline name##_cursor name##_lower_bound(name *t, const char *key) {   \
+    name##_cursor c    = {.head = &t->leaves};                                 \
+    name##_leaf  *leaf = name##_find_leaf(t, key, false);                      \
+    if (!leaf || leaf->hdr.nkeys == 0) return c;                               \
+    c.leaf = leaf;                                                             \
+    c.slot = name##_count(&leaf->hdr, key, false) - 1;                         \
+    name##_cursor_next(&c);                                                    \
+    return c;                                                                  \
+  }
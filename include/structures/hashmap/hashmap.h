@@ -0,0 +1,356 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Intrusive open-addressing hash map, Swiss table style.
+//
+// The table is an array of 64-byte groups, one cache line each: 8 control
+// bytes followed by 7 entry pointers. A full slot's control byte is 0x80
+// plus the low 7 bits of the key's hash; the others are HASHMAP_CTRL_EMPTY
+// or HASHMAP_CTRL_DELETED, and byte 7 is never used. Lookups start at the
+// group picked by the rest of the hash, compare the 7 bytes against the
+// tag at once (SSE2, or SWAR on other targets) and only dereference
+// entries whose tag matches, so a hit costs the group's cache line plus
+// the entry itself. Probing moves between groups triangularly and stops
+// at the first group with an empty slot.
+//
+// Growing is incremental: the full table becomes the old table and a new
+// one, sized for twice the entries, is allocated. Every insert and erase
+// then moves HASHMAP_MIGRATE_GROUPS groups of the old table, so no single
+// operation pays for rehashing the whole map. Until the move is done,
+// lookups that miss in the new table also probe the old one. Empty is
+// all zero bits, so new tables come from calloc and large ones are
+// faulted in page by page as the move fills them rather than cleared up
+// front.
+//
+// DEFINE_HASHMAP(name, entry_type, key_type, key_member, HASH, EQ)
+//   HASH(key)  - uint64_t hash of a key; all 64 bits should be mixed
+//   EQ(a, b)   - nonzero if two keys are equal
+// gives
+//   name##_init / name##_clear / name##_destroy / name##_size
+//   name##_search(m, key)        - entry or NULL
+//   name##_insert_or_get(m, e)   - the entry already holding e's key, else
+//                                  inserts e and returns it; NULL out of
+//                                  memory
+//   name##_upsert(m, e, &old)    - insert e, replacing and returning in old
+//                                  an entry with the same key; 0 or -1
+//   name##_erase(m, key)         - removed entry or NULL
+//   name##_reserve(m, n)         - room for n entries without growing
+//   name##_iterate(m, cb, ctx)   - every entry, in no particular order
+// The map stores pointers; entries must outlive their stay in it and keep
+// their key unchanged meanwhile.
+
+#define HASHMAP_GROUP_BYTES    64
+#define HASHMAP_GROUP_SLOTS    7
+#define HASHMAP_CTRL_EMPTY     0x00
+#define HASHMAP_CTRL_DELETED   0x01
+#define HASHMAP_CTRL_FULL      0x80 /* | 7 bits of hash */
+#define HASHMAP_MIGRATE_GROUPS 1
+
+/* finalizer of MurmurHash3, spreads every input bit over the result */
+static inline uint64_t hashmap_hash_u64(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xFF51AFD7ED558CCDULL;
+  x ^= x >> 33;
+  x *= 0xC4CEB9FE1A85EC53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+/* slots a table of g groups fills before growing: 7/8 of them */
+static inline size_t hashmap_max_full(size_t g) {
+  return g * HASHMAP_GROUP_SLOTS * 7 / 8;
+}
+
+// Slot masks: one bit per matching slot, walked lowest first. SSE2 gives
+// bit i for slot i, SWAR the top bit of byte i.
+#ifdef __SSE2__
+typedef uint32_t hashmap_mask;
+#define HASHMAP_MASK_STRIDE 1
+
+static inline hashmap_mask hashmap_match_byte(uint64_t ctrl, uint8_t b) {
+  __m128i v = _mm_set_epi64x(0, (long long)ctrl);
+  __m128i e = _mm_cmpeq_epi8(v, _mm_set1_epi8((char)b));
+  return (hashmap_mask)_mm_movemask_epi8(e) & 0x7F;
+}
+
+/* slots holding an entry: top bit set */
+static inline hashmap_mask hashmap_match_full(uint64_t ctrl) {
+  __m128i v = _mm_set_epi64x(0, (long long)ctrl);
+  return (hashmap_mask)_mm_movemask_epi8(v) & 0x7F;
+}
+#else
+typedef uint64_t hashmap_mask;
+#define HASHMAP_MASK_STRIDE 8
+#define HASHMAP_SLOT_BITS_  0x0080808080808080ULL
+
+static inline hashmap_mask hashmap_match_byte(uint64_t ctrl, uint8_t b) {
+  uint64_t x = ctrl ^ (b * 0x0101010101010101ULL);
+  /* exact zero-byte test: no carries between bytes */
+  uint64_t low = 0x7F7F7F7F7F7F7F7FULL;
+  return ~(((x & low) + low) | x | low) & HASHMAP_SLOT_BITS_;
+}
+
+static inline hashmap_mask hashmap_match_full(uint64_t ctrl) {
+  return ctrl & HASHMAP_SLOT_BITS_;
+}
+#endif
+
+static inline hashmap_mask hashmap_match_empty(uint64_t ctrl) {
+  return hashmap_match_byte(ctrl, HASHMAP_CTRL_EMPTY);
+}
+
+/* slots without an entry: empty or deleted */
+static inline hashmap_mask hashmap_match_free(uint64_t ctrl) {
+  return hashmap_match_full(~ctrl);
+}
+
+static inline int hashmap_mask_slot(hashmap_mask m) {
+  return __builtin_ctzll(m) / HASHMAP_MASK_STRIDE;
+}
+
+/* the 8 control bytes of a group, byte i in bits 8i..8i+7 */
+static inline uint64_t hashmap_ctrl_word(const uint8_t *ctrl) {
+  uint64_t c;
+  memcpy(&c, ctrl, sizeof(c));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  c = __builtin_bswap64(c);
+#endif
+  return c;
+}
+
+#define DEFINE_HASHMAP(name, entry_type, key_type, key_member, HASH, EQ)       \
+  typedef struct name##_group {                                                \
+    uint8_t     ctrl[8]; /* slots, then one unused byte */                     \
+    entry_type *slots[HASHMAP_GROUP_SLOTS];                                    \
+  } name##_group;                                                              \
+                                                                               \
+  _Static_assert(sizeof(name##_group) == HASHMAP_GROUP_BYTES,                  \
+                 #name ": a group must fill one cache line");                  \
+                                                                               \
+  typedef struct name##_table {                                                \
+    name##_group *groups; /* NULL before the first insert */                   \
+    void         *mem;    /* allocation holding groups */                      \
+    size_t        mask;   /* number of groups - 1 */                           \
+    size_t        size;                                                        \
+    size_t        growth_left; /* empty slots that may still be filled */      \
+  } name##_table;                                                              \
+                                                                               \
+  typedef struct name {                                                        \
+    name##_table cur;                                                          \
+    name##_table old;      /* draining into cur, groups NULL when not */       \
+    size_t       migrated; /* groups of old already moved */                   \
+  } name;                                                                      \
+                                                                               \
+  static inline void name##_init(name *m) { memset(m, 0, sizeof(*m)); }        \
+                                                                               \
+  static inline void name##_clear(name *m) {                                   \
+    free(m->cur.mem);                                                          \
+    free(m->old.mem);                                                          \
+    name##_init(m);                                                            \
+  }                                                                            \
+                                                                               \
+  static inline void name##_destroy(name *m) { name##_clear(m); }              \
+                                                                               \
+  static inline size_t name##_size(const name *m) {                            \
+    return m->cur.size + m->old.size;                                          \
+  }                                                                            \
+                                                                               \
+  /* every slot empty. calloc leaves large blocks to fresh zero pages */       \
+  static inline int name##_table_init(name##_table *tab, size_t groups) {      \
+    tab->mem = calloc(groups + 1, HASHMAP_GROUP_BYTES);                        \
+    if (!tab->mem) return -1;                                                  \
+    uintptr_t p = (uintptr_t)tab->mem + HASHMAP_GROUP_BYTES - 1;               \
+    tab->groups = (name##_group *)(p - p % HASHMAP_GROUP_BYTES);               \
+    tab->mask        = groups - 1;                                             \
+    tab->size        = 0;                                                      \
+    tab->growth_left = hashmap_max_full(groups);                               \
+    return 0;                                                                  \
+  }                                                                            \
+                                                                               \
+  /* slot holding key, or NULL */                                              \
+  static inline entry_type **name##_table_find(const name##_table *tab,        \
+                                               key_type key, uint64_t h) {     \
+    if (!tab->groups) return NULL;                                             \
+    uint8_t tag = HASHMAP_CTRL_FULL | (h & 0x7F);                              \
+    size_t  g   = (h >> 7) & tab->mask;                                        \
+    for (size_t step = 1;; ++step) {                                           \
+      name##_group *grp = &tab->groups[g];                                     \
+      uint64_t      c   = hashmap_ctrl_word(grp->ctrl);                        \
+      for (hashmap_mask mt = hashmap_match_byte(c, tag); mt; mt &= mt - 1) {   \
+        entry_type **s = &grp->slots[hashmap_mask_slot(mt)];                   \
+        if (EQ((*s)->key_member, key)) return s;                               \
+      }                                                                        \
+      if (hashmap_match_empty(c)) return NULL;                                 \
+      g = (g + step) & tab->mask;                                              \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  /* put e, whose key is not in tab, in the first free slot of its probe       \
+   * sequence. reusing a deleted slot costs no growth */                       \
+  static inline void name##_table_put(name##_table *tab, entry_type *e,        \
+                                      uint64_t h) {                            \
+    size_t g = (h >> 7) & tab->mask;                                           \
+    for (size_t step = 1;; ++step) {                                           \
+      name##_group *grp = &tab->groups[g];                                     \
+      hashmap_mask  mf  = hashmap_match_free(hashmap_ctrl_word(grp->ctrl));    \
+      if (mf) {                                                                \
+        int i = hashmap_mask_slot(mf);                                         \
+        if (grp->ctrl[i] == HASHMAP_CTRL_EMPTY) tab->growth_left--;            \
+        grp->ctrl[i]  = HASHMAP_CTRL_FULL | (h & 0x7F);                        \
+        grp->slots[i] = e;                                                     \
+        tab->size++;                                                           \
+        return;                                                                \
+      }                                                                        \
+      g = (g + step) & tab->mask;                                              \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  /* a slot may go back to empty only in a group that still has an empty       \
+   * one: such a group was never full, so no probe sequence runs through       \
+   * it. otherwise it becomes a tombstone */                                   \
+  static inline void name##_table_remove(name##_table *tab, entry_type **s) {  \
+    /* groups are aligned to their size */                                     \
+    uintptr_t     off = (uintptr_t)s % HASHMAP_GROUP_BYTES;                    \
+    name##_group *grp = (name##_group *)((uintptr_t)s - off);                  \
+    int           i   = (int)(s - grp->slots);                                 \
+    if (hashmap_match_empty(hashmap_ctrl_word(grp->ctrl))) {                   \
+      grp->ctrl[i] = HASHMAP_CTRL_EMPTY;                                       \
+      tab->growth_left++;                                                      \
+    } else {                                                                   \
+      grp->ctrl[i] = HASHMAP_CTRL_DELETED;                                     \
+    }                                                                          \
+    tab->size--;                                                               \
+  }                                                                            \
+                                                                               \
+  /* move up to n groups of the old table into cur. moved slots become         \
+   * tombstones so probes for keys still in old run past them */               \
+  static inline void name##_migrate(name *m, size_t n) {                       \
+    while (n-- && m->old.groups) {                                             \
+      name##_group *grp = &m->old.groups[m->migrated];                         \
+      for (hashmap_mask mf = hashmap_match_full(hashmap_ctrl_word(grp->ctrl)); \
+           mf; mf &= mf - 1) {                                                 \
+        int         i = hashmap_mask_slot(mf);                                 \
+        entry_type *e = grp->slots[i];                                         \
+        name##_table_put(&m->cur, e, HASH(e->key_member));                     \
+        grp->ctrl[i] = HASHMAP_CTRL_DELETED;                                   \
+        m->old.size--;                                                         \
+      }                                                                        \
+      if (++m->migrated > m->old.mask) {                                       \
+        free(m->old.mem);                                                      \
+        memset(&m->old, 0, sizeof(m->old));                                    \
+        m->migrated = 0;                                                       \
+      }                                                                        \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  /* finish any move, then start one into a table with room for need           \
+   * entries */                                                                \
+  static inline int name##_grow(name *m, size_t need) {                        \
+    name##_table next;                                                         \
+    size_t       groups = 1;                                                   \
+    name##_migrate(m, SIZE_MAX);                                               \
+    while (hashmap_max_full(groups) < need) groups <<= 1;                      \
+    if (name##_table_init(&next, groups)) return -1;                           \
+    m->old      = m->cur;                                                      \
+    m->cur      = next;                                                        \
+    m->migrated = 0;                                                           \
+    return 0;                                                                  \
+  }                                                                            \
+                                                                               \
+  static inline entry_type *name##_search(name *m, key_type key) {             \
+    uint64_t     h = HASH(key);                                                \
+    entry_type **s = name##_table_find(&m->cur, key, h);                       \
+    if (!s && m->old.groups) s = name##_table_find(&m->old, key, h);           \
+    return s ? *s : NULL;                                                      \
+  }                                                                            \
+                                                                               \
+  /* slot holding key in either table */                                       \
+  static inline entry_type **name##_find(name *m, key_type key, uint64_t h,    \
+                                         name##_table **tab) {                 \
+    entry_type **s = name##_table_find(&m->cur, key, h);                       \
+    *tab           = &m->cur;                                                  \
+    if (!s && m->old.groups) {                                                 \
+      s    = name##_table_find(&m->old, key, h);                               \
+      *tab = &m->old;                                                          \
+    }                                                                          \
+    return s;                                                                  \
+  }                                                                            \
+                                                                               \
+  /* add e, whose key is in neither table. cur always keeps room for every     \
+   * entry still in old: growth_left >= old.size. growing doubles a full       \
+   * table and rebuilds one that is mostly tombstones at its size */           \
+  static inline int name##_add(name *m, entry_type *e, uint64_t h) {           \
+    size_t n = name##_size(m);                                                 \
+    if (m->cur.growth_left <= m->old.size && name##_grow(m, n ? 2 * n : 1))    \
+      return -1;                                                               \
+    name##_table_put(&m->cur, e, h);                                           \
+    return 0;                                                                  \
+  }                                                                            \
+                                                                               \
+  static inline entry_type *name##_insert_or_get(name *m, entry_type *e) {     \
+    uint64_t      h = HASH(e->key_member);                                     \
+    name##_table *tab;                                                         \
+    name##_migrate(m, HASHMAP_MIGRATE_GROUPS);                                 \
+    entry_type **s = name##_find(m, e->key_member, h, &tab);                   \
+    if (s) return *s;                                                          \
+    return name##_add(m, e, h) ? NULL : e;                                     \
+  }                                                                            \
+                                                                               \
+  static inline int name##_upsert(name *m, entry_type *e, entry_type **old) {  \
+    uint64_t      h = HASH(e->key_member);                                     \
+    name##_table *tab;                                                         \
+    name##_migrate(m, HASHMAP_MIGRATE_GROUPS);                                 \
+    entry_type **s = name##_find(m, e->key_member, h, &tab);                   \
+    if (old) *old = s ? *s : NULL;                                             \
+    if (s) {                                                                   \
+      *s = e;                                                                  \
+      return 0;                                                                \
+    }                                                                          \
+    return name##_add(m, e, h);                                                \
+  }                                                                            \
+                                                                               \
+  static inline entry_type *name##_erase(name *m, key_type key) {              \
+    name##_table *tab;                                                         \
+    name##_migrate(m, HASHMAP_MIGRATE_GROUPS);                                 \
+    entry_type **s = name##_find(m, key, HASH(key), &tab);                     \
+    if (!s) return NULL;                                                       \
+    entry_type *e = *s;                                                        \
+    name##_table_remove(tab, s);                                               \
+    return e;                                                                  \
+  }                                                                            \
+                                                                               \
+  /* room for n entries in total; moves everything at once, so it is the       \
+   * one call that can take time proportional to the map */                    \
+  static inline int name##_reserve(name *m, size_t n) {                        \
+    name##_migrate(m, SIZE_MAX);                                               \
+    if (n <= m->cur.size + m->cur.growth_left) return 0;                       \
+    if (name##_grow(m, n)) return -1;                                          \
+    name##_migrate(m, SIZE_MAX);                                               \
+    return 0;                                                                  \
+  }                                                                            \
+                                                                               \
+  static inline void name##_table_iterate(                                     \
+      name##_table *tab, void (*cb)(entry_type *, void *), void *ctx) {        \
+    if (!tab->groups) return;                                                  \
+    for (size_t g = 0; g <= tab->mask; ++g) {                                  \
+      name##_group *grp = &tab->groups[g];                                     \
+      for (hashmap_mask mf = hashmap_match_full(hashmap_ctrl_word(grp->ctrl)); \
+           mf; mf &= mf - 1)                                                   \
+        cb(grp->slots[hashmap_mask_slot(mf)], ctx);                            \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  static inline void name##_iterate(name *m, void (*cb)(entry_type *, void *), \
+                                    void *ctx) {                               \
+    name##_table_iterate(&m->cur, cb, ctx);                                    \
+    name##_table_iterate(&m->old, cb, ctx);                                    \
+  }
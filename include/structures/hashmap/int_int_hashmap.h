@@ -0,0 +1,15 @@
+#pragma once
+
+#include "structures.h"
+#include "structures/hashmap/hashmap.h"
+
+typedef struct {
+  int key;
+  int value;
+} IntIntHashMap;
+
+#define HASH_INT(k)  hashmap_hash_u64((uint32_t)(k))
+#define EQ_INT(a, b) ((a) == (b))
+DEFINE_HASHMAP(intintmap, IntIntHashMap, int, key, HASH_INT, EQ_INT)
+
+STRUCTURES_EXTERN void printIntIntHashMap(IntIntHashMap *, void *);
@@ -10,6 +10,48 @@
 
 #include "structures.h"
 #include "structures/bplustree/int_int_bplustree.h"
+#include "structures/bplustree/olc.h"
+#include "structures/bplustree/parallel.h"
+#include "structures/bplustree/snapshot.h"
+#include "structures/bplustree/strtree.h"
+
+#define TEST_ENTRIES 1000
+
+DEFINE_BTREE_OPTS(arenatree, IntIntBPlusTree, int, key, 3, CMP_INT,
+                  BTREE_OPT_ARENA)
+DEFINE_BTREE_SIZED(pagetree, IntIntBPlusTree, int, key, 4096, CMP_INT)
+DEFINE_BTREE_SNAPSHOT(arenatree)
+DEFINE_BTREE_SNAPSHOT(pagetree)
+DEFINE_BTREE_PARALLEL(arenatree)
+DEFINE_BTREE_PARALLEL(intinttree)
+DEFINE_BTREE_OPTS(statstree, IntIntBPlusTree, int, key, 4, CMP_INT,
+                  BTREE_OPT_STATS)
+DEFINE_BTREE_OPTS(counttree, IntIntBPlusTree, int, key, 3, CMP_INT,
+                  BTREE_OPT_COUNTS | BTREE_OPT_ARENA)
+
+/* keys narrower than the node header's padding */
+typedef struct {
+  char  c;
+  short s;
+} NarrowEntry;
+
+DEFINE_BTREE_SIZED(chartree, NarrowEntry, char, c, 256, CMP_INT)
+DEFINE_BTREE_SIZED_OPTS(charcounttree, NarrowEntry, char, c, 256, CMP_INT,
+                        BTREE_OPT_COUNTS)
+DEFINE_BTREE_SIZED(shorttree, NarrowEntry, short, s, 256, CMP_INT)
+DEFINE_BTREE_SIZED_OPTS(shortcounttree, NarrowEntry, short, s, 256, CMP_INT,
+                        BTREE_OPT_COUNTS)
+
+typedef struct {
+  const char *key;
+  int         value;
+} StrEntry;
+
+/* smallest nodes: order 3, 3 keys per leaf */
+DEFINE_BTREE_STR(strkeytree, StrEntry, key, 96)
+
+/* small nodes so that threads split and unlink often */
+DEFINE_BTREE_OLC(olctree, IntIntBPlusTree, int, key, 4, CMP_INT)
 
 static void test_b_plus_tree_init(void **_) {
   intinttree tree;
@@ -28,6 +70,7 @@ static void test_b_plus_tree_insert(void **_) {
   intinttree_insert(&tree, &first_entry);
 
   assert_non_null(tree.leaves.next);
+  intinttree_destroy(&tree);
 }
 
 void intintree_get_entry_string(IntIntBPlusTree *, void *);
@@ -47,6 +90,378 @@ static void test_b_plus_tree_iterate(void **_) {
   intinttree_iterate(&tree, intintree_get_entry_string, &count);
 
   assert_int_equal((int)count, 1);
+  intinttree_destroy(&tree);
+}
+
+static void count_in_order(IntIntBPlusTree *, void *);
+static void count_in_order(IntIntBPlusTree *e, void *next_key) {
+  assert_int_equal(e->key, *(int *)next_key);
+  ++(*(int *)next_key);
+}
+
+/* entries arrive in the order of their values */
+static void count_value_order(IntIntBPlusTree *, void *);
+static void count_value_order(IntIntBPlusTree *e, void *next_value) {
+  assert_int_equal(e->value, *(int *)next_value);
+  ++(*(int *)next_value);
+}
+
+static void test_b_plus_tree_clear(void **_) {
+  intinttree tree;
+  intinttree_init(&tree);
+
+  IntIntBPlusTree entries[TEST_ENTRIES];
+  for (int i = 0; i < TEST_ENTRIES; ++i) {
+    entries[i] = (IntIntBPlusTree){.key = i, .value = -i};
+    intinttree_insert(&tree, &entries[i]);
+  }
+  intinttree_clear(&tree);
+
+  assert_null(tree.root);
+  assert_true(tree.leaves.next == &tree.leaves);
+  assert_null(intinttree_search(&tree, 0));
+
+  intinttree_insert(&tree, &entries[0]);
+  assert_ptr_equal(intinttree_search(&tree, 0), &entries[0]);
+  intinttree_destroy(&tree);
+}
+
+static void test_b_plus_tree_arena(void **_) {
+  arenatree tree;
+  arenatree_init(&tree);
+
+  IntIntBPlusTree entries[TEST_ENTRIES];
+  for (int i = 0; i < TEST_ENTRIES; ++i) {
+    entries[i] = (IntIntBPlusTree){.key = (i * 7) % TEST_ENTRIES, .value = i};
+    assert_int_equal(arenatree_insert(&tree, &entries[i]), 0);
+  }
+  for (int i = 0; i < TEST_ENTRIES; ++i)
+    assert_ptr_equal(arenatree_search(&tree, entries[i].key), &entries[i]);
+  int next = 0;
+  arenatree_iterate(&tree, count_in_order, &next);
+  assert_int_equal(next, TEST_ENTRIES);
+  assert_true(tree.leaf_arena.live > 0);
+
+  size_t slabs = tree.leaf_arena.nslabs;
+  arenatree_clear(&tree);
+  assert_null(tree.root);
+  assert_int_equal(tree.leaf_arena.live, 0);
+  assert_int_equal(tree.leaf_arena.nslabs, slabs);
+
+  /* refill reuses the kept slabs */
+  for (int i = 0; i < TEST_ENTRIES; ++i) arenatree_insert(&tree, &entries[i]);
+  assert_int_equal(tree.leaf_arena.nslabs, slabs);
+
+  arenatree_destroy(&tree);
+  assert_null(tree.root);
+  assert_int_equal(tree.leaf_arena.nslabs, 0);
+}
+
+static void test_b_plus_tree_insert_order(void **_) {
+  intinttree tree;
+  intinttree_init(&tree);
+
+  static IntIntBPlusTree entries[TEST_ENTRIES];
+  for (int i = 0; i < TEST_ENTRIES; ++i) {
+    /* 7 is coprime with TEST_ENTRIES: every key once, out of order */
+    entries[i] = (IntIntBPlusTree){.key = (i * 7) % TEST_ENTRIES, .value = i};
+    intinttree_insert(&tree, &entries[i]);
+  }
+
+  int next = 0;
+  intinttree_iterate(&tree, count_in_order, &next);
+  assert_int_equal(next, TEST_ENTRIES);
+  for (int i = 0; i < TEST_ENTRIES; ++i)
+    assert_ptr_equal(intinttree_search(&tree, entries[i].key), &entries[i]);
+  assert_null(intinttree_search(&tree, TEST_ENTRIES));
+  intinttree_destroy(&tree);
+}
+
+static void test_b_plus_tree_bulk_load(void **_) {
+  static IntIntBPlusTree  entries[TEST_ENTRIES];
+  static IntIntBPlusTree *sorted[TEST_ENTRIES];
+  for (int i = 0; i < TEST_ENTRIES; ++i) {
+    entries[i] = (IntIntBPlusTree){.key = i, .value = -i};
+    sorted[i]  = &entries[i];
+  }
+
+  const double fills[] = {1.0, 0.7, 0.01};
+  const size_t sizes[] = {0, 1, 2, 3, 5, 17, TEST_ENTRIES};
+  for (size_t f = 0; f < sizeof(fills) / sizeof(fills[0]); ++f) {
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+      arenatree tree;
+      arenatree_init(&tree);
+      assert_int_equal(arenatree_bulk_load(&tree, sorted, sizes[s], fills[f]),
+                       0);
+      int next = 0;
+      arenatree_iterate(&tree, count_in_order, &next);
+      assert_int_equal(next, (int)sizes[s]);
+      for (int i = 0; i < (int)sizes[s]; ++i)
+        assert_ptr_equal(arenatree_search(&tree, i), &entries[i]);
+      assert_null(arenatree_search(&tree, (int)sizes[s]));
+
+      /* the tree stays a regular tree after the bulk load */
+      IntIntBPlusTree extra = {.key = -1};
+      assert_int_equal(arenatree_insert(&tree, &extra), 0);
+      assert_ptr_equal(arenatree_search(&tree, -1), &extra);
+      arenatree_destroy(&tree);
+    }
+  }
+
+  intinttree tree;
+  intinttree_init(&tree);
+  sorted[0] = &entries[TEST_ENTRIES - 1];
+  assert_int_equal(intinttree_bulk_load(&tree, sorted, TEST_ENTRIES, 1.0), -1);
+  assert_null(tree.root);
+  intinttree_destroy(&tree);
+}
+
+/* name's nodes fit in bytes, one more key or child would not, and the         \
+ * sizing macros give the sizes of the real layouts */                         \
+#define ASSERT_SIZED(name, key_type, bytes)                                    \
+  do {                                                                         \
+    assert_true(name##_INNER_BYTES <= (bytes));                                \
+    assert_true(sizeof(name##_leaf) <= (bytes));                               \
+    assert_true(BTREE_INNER_BYTES_OPTS(name##_ORDER + 1, key_type,             \
+                                       name##_OPTS) > (bytes));                \
+    assert_true(BTREE_LEAF_BYTES(name##_LEAF_KEYS + 1, key_type) > (bytes));   \
+    assert_int_equal(BTREE_INNER_BYTES_OPTS(name##_ORDER, key_type,            \
+                                            name##_OPTS),                      \
+                     name##_INNER_BYTES);                                      \
+    assert_int_equal(BTREE_LEAF_BYTES(name##_LEAF_KEYS, key_type),             \
+                     sizeof(name##_leaf));                                     \
+  } while (0)
+
+static void test_b_plus_tree_sized(void **_) {
+  assert_true(sizeof(intinttree_inner) <= 256);
+  assert_true(sizeof(intinttree_leaf) <= 256);
+  assert_true(sizeof(pagetree_inner) <= 4096);
+  assert_true(sizeof(pagetree_leaf) <= 4096);
+  /* one more key or child would not fit */
+  assert_true(BTREE_INNER_BYTES(intinttree_ORDER + 1, int) > 256);
+  assert_true(BTREE_LEAF_BYTES(intinttree_LEAF_KEYS + 1, int) > 256);
+  assert_true(BTREE_INNER_BYTES(pagetree_ORDER + 1, int) > 4096);
+  assert_true(BTREE_LEAF_BYTES(pagetree_LEAF_KEYS + 1, int) > 4096);
+  ASSERT_SIZED(chartree, char, 256);
+  ASSERT_SIZED(charcounttree, char, 256);
+  ASSERT_SIZED(shorttree, short, 256);
+  ASSERT_SIZED(shortcounttree, short, 256);
+  /* the sizing macros match the layouts, with and without counts */
+  assert_int_equal(BTREE_INNER_BYTES(counttree_ORDER, int),
+                   sizeof(counttree_inner));
+  assert_int_equal(BTREE_INNER_BYTES_OPTS(counttree_ORDER, int,
+                                          counttree_OPTS),
+                   counttree_INNER_BYTES);
+  assert_int_equal(intinttree_INNER_BYTES, sizeof(intinttree_inner));
+
+  pagetree tree;
+  pagetree_init(&tree);
+  static IntIntBPlusTree entries[TEST_ENTRIES * 10];
+  for (int i = 0; i < TEST_ENTRIES * 10; ++i) {
+    entries[i] = (IntIntBPlusTree){.key = i, .value = i};
+    assert_int_equal(pagetree_insert(&tree, &entries[i]), 0);
+  }
+  for (int i = 0; i < TEST_ENTRIES * 10; ++i)
+    assert_ptr_equal(pagetree_search(&tree, i), &entries[i]);
+  pagetree_destroy(&tree);
+}
+
+static void test_b_plus_tree_search_kernels(void **_) {
+  enum { MAX_N = 400 };
+  int32_t   k32[MAX_N] = {0};
+  long long k64[MAX_N] = {0};
+  for (int n = 0; n <= MAX_N; n = n < 40 ? n + 1 : n * 3 / 2) {
+    for (int i = 0; i < n; ++i) {
+      /* runs of duplicates, both type extremes at the ends */
+      k32[i] = (i / 3) * 2 - n / 3;
+      k64[i] = (long long)k32[i] * (1LL << 33);
+    }
+    if (n) {
+      k32[0] = INT32_MIN, k32[n - 1] = INT32_MAX;
+      k64[0] = INT64_MIN, k64[n - 1] = INT64_MAX;
+    }
+    for (int probe = -n - 2; probe <= n + 2; ++probe) {
+      int32_t   x32 = probe;
+      long long x64 = (long long)probe * (1LL << 33);
+      int       le32 = 0, lt32 = 0, le64 = 0, lt64 = 0;
+      for (int i = 0; i < n; ++i) {
+        le32 += k32[i] <= x32, lt32 += k32[i] < x32;
+        le64 += k64[i] <= x64, lt64 += k64[i] < x64;
+      }
+      assert_int_equal(BTREE_SEARCH_KERNEL(x32, le)(k32, n, &x32), le32);
+      assert_int_equal(BTREE_SEARCH_KERNEL(x32, lt)(k32, n, &x32), lt32);
+      assert_int_equal(BTREE_SEARCH_KERNEL(x64, le)(k64, n, &x64), le64);
+      assert_int_equal(BTREE_SEARCH_KERNEL(x64, lt)(k64, n, &x64), lt64);
+    }
+    int32_t   max32 = INT32_MAX, min32 = INT32_MIN;
+    long long max64 = INT64_MAX;
+    assert_int_equal(btree_count_le_i32(k32, n, &max32), n);
+    assert_int_equal(btree_count_lt_i32(k32, n, &min32), 0);
+    assert_int_equal(btree_count_le_i64(k64, n, &max64), n);
+  }
+}
+
+static void test_b_plus_tree_cursor(void **_) {
+  arenatree tree;
+  arenatree_init(&tree);
+
+  arenatree_cursor c = arenatree_lower_bound(&tree, 0);
+  assert_false(arenatree_cursor_valid(&c));
+
+  /* even keys 0, 2, ..., 2 * (TEST_ENTRIES - 1) */
+  static IntIntBPlusTree entries[TEST_ENTRIES];
+  for (int i = 0; i < TEST_ENTRIES; ++i) {
+    entries[i] = (IntIntBPlusTree){.key = 2 * i, .value = i};
+    arenatree_insert(&tree, &entries[i]);
+  }
+
+  c = arenatree_lower_bound(&tree, 7);
+  assert_int_equal(arenatree_cursor_key(&c), 8);
+  c = arenatree_lower_bound(&tree, 8);
+  assert_ptr_equal(arenatree_cursor_entry(&c), &entries[4]);
+  c = arenatree_upper_bound(&tree, 8);
+  assert_int_equal(arenatree_cursor_key(&c), 10);
+  arenatree_cursor_prev(&c);
+  arenatree_cursor_prev(&c);
+  assert_int_equal(arenatree_cursor_key(&c), 6);
+
+  c = arenatree_upper_bound(&tree, 2 * TEST_ENTRIES);
+  assert_false(arenatree_cursor_valid(&c));
+  arenatree_cursor_prev(&c);
+  assert_int_equal(arenatree_cursor_key(&c), 2 * (TEST_ENTRIES - 1));
+  c = arenatree_cursor_first(&tree);
+  assert_int_equal(arenatree_cursor_key(&c), 0);
+  arenatree_cursor_prev(&c);
+  assert_false(arenatree_cursor_valid(&c));
+  c = arenatree_cursor_last(&tree);
+  assert_int_equal(arenatree_cursor_key(&c), 2 * (TEST_ENTRIES - 1));
+
+  /* [100, 200) holds keys 100..198 */
+  int seen = 0;
+  BTREE_RANGE_FOREACH(arenatree, &tree, 100, 200, cur) {
+    assert_int_equal(arenatree_cursor_key(&cur), 100 + 2 * seen);
+    ++seen;
+  }
+  assert_int_equal(seen, 50);
+  seen = 0;
+  BTREE_RANGE_FOREACH(arenatree, &tree, 101, 2 * TEST_ENTRIES, cur) {
+    if (arenatree_cursor_key(&cur) >= 111) break;
+    ++seen;
+  }
+  assert_int_equal(seen, 5);
+
+  /* slices cover the same range, one leaf at a time */
+  arenatree_cursor         sc = arenatree_lower_bound(&tree, 99);
+  IntIntBPlusTree *const *slice;
+  int                      total = 0, n;
+  while ((n = arenatree_cursor_slice(&sc, 301, &slice)) > 0) {
+    assert_true(n <= arenatree_LEAF_KEYS);
+    for (int i = 0; i < n; ++i, ++total)
+      assert_int_equal(slice[i]->key, 100 + 2 * total);
+  }
+  assert_int_equal(total, 101);
+
+  /* a run of duplicates spans several leaves, lower_bound finds all */
+  IntIntBPlusTree dups[20];
+  for (int i = 0; i < 20; ++i) {
+    dups[i] = (IntIntBPlusTree){.key = 501, .value = i};
+    arenatree_insert(&tree, &dups[i]);
+  }
+  seen = 0;
+  BTREE_RANGE_FOREACH(arenatree, &tree, 501, 502, cur) ++seen;
+  assert_int_equal(seen, 20);
+
+  arenatree_destroy(&tree);
+}
+
+/* walk the tree checking key bounds, leaf depth and that the leaf chain
+ * lists the leaves in order; returns the number of entries below n */
+static size_t check_subtree(arenatree_node *n, const int *lo, const int *hi,
+                            int depth, int *leaf_depth, list_head **chain) {
+  if (n->is_leaf) {
+    arenatree_leaf *leaf = arenatree_as_leaf(n);
+    if (*leaf_depth < 0) *leaf_depth = depth;
+    assert_int_equal(depth, *leaf_depth);
+    assert_ptr_equal(*chain, &leaf->leaf_link);
+    *chain = leaf->leaf_link.next;
+    for (int i = 0; i < n->nkeys; ++i) {
+      assert_int_equal(leaf->keys[i], leaf->leaf_entries[i]->key);
+      if (i) assert_true(leaf->keys[i - 1] <= leaf->keys[i]);
+      if (lo) assert_true(leaf->keys[i] >= *lo);
+      if (hi) assert_true(leaf->keys[i] < *hi);
+    }
+    return (size_t)n->nkeys;
+  }
+  arenatree_inner *in    = arenatree_as_inner(n);
+  size_t           total = 0;
+  assert_true(n->nkeys >= 1);
+  for (int i = 0; i <= n->nkeys; ++i)
+    total += check_subtree(in->children[i], i ? &in->keys[i - 1] : lo,
+                           i < n->nkeys ? &in->keys[i] : hi, depth + 1,
+                           leaf_depth, chain);
+  return total;
+}
+
+static size_t check_tree(arenatree *tree) {
+  if (!tree->root) {
+    assert_true(tree->leaves.next == &tree->leaves);
+    return 0;
+  }
+  int        leaf_depth = -1;
+  list_head *chain      = tree->leaves.next;
+  size_t     n = check_subtree(tree->root, NULL, NULL, 0, &leaf_depth, &chain);
+  assert_ptr_equal(chain, &tree->leaves);
+  return n;
+}
+
+static void test_b_plus_tree_erase(void **_) {
+  static IntIntBPlusTree entries[TEST_ENTRIES];
+  const int              mins[][2] = {{0, 0}, {1, 1}, {-5, 99}};
+  for (size_t m = 0; m < sizeof(mins) / sizeof(mins[0]); ++m) {
+    arenatree tree;
+    arenatree_init(&tree);
+    arenatree_set_merge_thresholds(&tree, mins[m][0], mins[m][1]);
+    for (int i = 0; i < TEST_ENTRIES; ++i) {
+      entries[i] = (IntIntBPlusTree){.key = (i * 7) % TEST_ENTRIES, .value = i};
+      arenatree_insert(&tree, &entries[i]);
+    }
+    size_t full_nodes = tree.leaf_arena.live + tree.inner_arena.live;
+
+    /* drop the even keys, in scattered order */
+    for (int i = 0; i < TEST_ENTRIES; ++i) {
+      int key = (i * 13) % TEST_ENTRIES;
+      if (key % 2) continue;
+      IntIntBPlusTree *e = arenatree_erase(&tree, key);
+      assert_non_null(e);
+      assert_int_equal(e->key, key);
+      assert_null(arenatree_erase(&tree, key));
+    }
+    assert_int_equal(check_tree(&tree), TEST_ENTRIES / 2);
+    for (int key = 0; key < TEST_ENTRIES; ++key)
+      assert_true((arenatree_search(&tree, key) != NULL) == (key % 2 == 1));
+    if (m > 0) /* merging keeps node count in step with the entries */
+      assert_true(tree.leaf_arena.live + tree.inner_arena.live <
+                  full_nodes * 3 / 4);
+
+    for (int key = 1; key < TEST_ENTRIES; key += 2)
+      assert_non_null(arenatree_erase(&tree, key));
+    assert_null(tree.root);
+    assert_int_equal(check_tree(&tree), 0);
+    assert_int_equal(tree.leaf_arena.live + tree.inner_arena.live, 0);
+    arenatree_destroy(&tree);
+  }
+
+  /* duplicates: every copy can be erased, then the key is gone */
+  arenatree tree;
+  arenatree_init(&tree);
+  for (int i = 0; i < 100; ++i) {
+    entries[i] = (IntIntBPlusTree){.key = i % 10 == 0 ? 50 : i, .value = i};
+    arenatree_insert(&tree, &entries[i]);
+  }
+  for (int i = 0; i < 10; ++i) assert_non_null(arenatree_erase(&tree, 50));
+  assert_null(arenatree_erase(&tree, 50));
+  assert_int_equal(check_tree(&tree), 90);
+  arenatree_destroy(&tree);
 }
 
 // static void test_b_plus_tree_search(void **_) {
@@ -56,11 +471,723 @@ static void test_b_plus_tree_iterate(void **_) {
 //   assert_non_null(&tree);
 // }
 
+static void test_b_plus_tree_upsert(void **_) {
+  static IntIntBPlusTree entries[TEST_ENTRIES];
+  static IntIntBPlusTree again[TEST_ENTRIES];
+
+  /* ascending keys, each one twice: appends fill every leaf but the last */
+  arenatree tree;
+  arenatree_init(&tree);
+  for (int i = 0; i < TEST_ENTRIES; ++i) {
+    entries[i] = (IntIntBPlusTree){.key = i / 2, .value = i};
+    assert_int_equal(arenatree_insert(&tree, &entries[i]), 0);
+  }
+  assert_int_equal(check_tree(&tree), TEST_ENTRIES);
+  list_head *last = tree.leaves.prev;
+  for (list_head *p = tree.leaves.next; p != last; p = p->next)
+    assert_int_equal(container_of(p, arenatree_leaf, leaf_link)->hdr.nkeys,
+                     arenatree_LEAF_KEYS);
+  /* equal keys keep insertion order */
+  arenatree_cursor c = arenatree_cursor_first(&tree);
+  for (int i = 0; i < TEST_ENTRIES; ++i, arenatree_cursor_next(&c))
+    assert_ptr_equal(arenatree_cursor_entry(&c), &entries[i]);
+  arenatree_destroy(&tree);
+
+  intinttree unique;
+  intinttree_init(&unique);
+  for (int i = 0; i < TEST_ENTRIES; ++i) {
+    int key    = (i * 7) % TEST_ENTRIES;
+    entries[i] = (IntIntBPlusTree){.key = key, .value = i};
+    again[i]   = (IntIntBPlusTree){.key = key, .value = -i};
+    assert_ptr_equal(intinttree_insert_or_get(&unique, &entries[i]),
+                     &entries[i]);
+  }
+  for (int i = 0; i < TEST_ENTRIES; ++i)
+    assert_ptr_equal(intinttree_insert_or_get(&unique, &again[i]),
+                     &entries[i]);
+  for (int i = 0; i < TEST_ENTRIES; i += 2) {
+    IntIntBPlusTree *old = &again[i];
+    assert_int_equal(intinttree_upsert(&unique, &again[i], &old), 0);
+    assert_ptr_equal(old, &entries[i]);
+  }
+  int next = 0;
+  intinttree_iterate(&unique, count_in_order, &next);
+  assert_int_equal(next, TEST_ENTRIES);
+  for (int i = 0; i < TEST_ENTRIES; ++i)
+    assert_ptr_equal(intinttree_search(&unique, again[i].key),
+                     i % 2 ? &entries[i] : &again[i]);
+
+  /* a new key goes in, old is NULL */
+  IntIntBPlusTree extra = {.key = TEST_ENTRIES};
+  IntIntBPlusTree *old  = &extra;
+  assert_int_equal(intinttree_upsert(&unique, &extra, &old), 0);
+  assert_null(old);
+  assert_ptr_equal(intinttree_search(&unique, TEST_ENTRIES), &extra);
+  intinttree_destroy(&unique);
+}
+
+static void test_b_plus_tree_search_batch(void **_) {
+  enum { NKEYS = TEST_ENTRIES * 3 };
+  static IntIntBPlusTree  entries[TEST_ENTRIES];
+  static int              keys[NKEYS];
+  static IntIntBPlusTree *out[NKEYS];
+
+  arenatree  small;
+  intinttree tree;
+  arenatree_init(&small);
+  intinttree_init(&tree);
+  /* empty trees find nothing */
+  keys[0] = 0;
+  arenatree_search_batch(&small, keys, 1, out);
+  assert_null(out[0]);
+  intinttree_search_sorted_batch(&tree, keys, 1, out);
+  assert_null(out[0]);
+
+  /* even keys only, so every other probe misses */
+  for (int i = 0; i < TEST_ENTRIES; ++i) {
+    entries[i] = (IntIntBPlusTree){.key = i * 2, .value = i};
+    arenatree_insert(&small, &entries[i]);
+    intinttree_insert(&tree, &entries[i]);
+  }
+  for (int i = 0; i < NKEYS; ++i) keys[i] = (i * 7919) % (NKEYS + 2) - 1;
+  /* batch sizes around the group size, all of them unsorted */
+  const size_t sizes[] = {0, 1, BTREE_BATCH_GROUP - 1, BTREE_BATCH_GROUP + 1,
+                          NKEYS};
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+    arenatree_search_batch(&small, keys, sizes[s], out);
+    for (size_t i = 0; i < sizes[s]; ++i)
+      assert_ptr_equal(out[i], arenatree_search(&small, keys[i]));
+    intinttree_search_batch(&tree, keys, sizes[s], out);
+    for (size_t i = 0; i < sizes[s]; ++i)
+      assert_ptr_equal(out[i], intinttree_search(&tree, keys[i]));
+  }
+
+  /* sorted batches with repeats and gaps */
+  for (int i = 0; i < NKEYS; ++i) keys[i] = i * 2 / 3 - 2;
+  arenatree_search_sorted_batch(&small, keys, NKEYS, out);
+  for (int i = 0; i < NKEYS; ++i)
+    assert_ptr_equal(out[i], arenatree_search(&small, keys[i]));
+  intinttree_search_sorted_batch(&tree, keys, NKEYS, out);
+  for (int i = 0; i < NKEYS; ++i)
+    assert_ptr_equal(out[i], intinttree_search(&tree, keys[i]));
+
+  arenatree_destroy(&small);
+  intinttree_destroy(&tree);
+}
+
+static void test_b_plus_tree_stats(void **_) {
+  static IntIntBPlusTree entries[TEST_ENTRIES];
+  statstree              tree;
+  btree_stats            st;
+  statstree_init(&tree);
+  statstree_stats(&tree, &st);
+  assert_int_equal(st.height, 0);
+  assert_int_equal(st.leaves, 0);
+
+  /* ascending keys: every insert after the first skips the descent */
+  for (int i = 0; i < TEST_ENTRIES; ++i) {
+    entries[i] = (IntIntBPlusTree){.key = i, .value = i};
+    statstree_insert(&tree, &entries[i]);
+  }
+  statstree_stats(&tree, &st);
+  assert_int_equal(st.counters.inserts, TEST_ENTRIES);
+  assert_int_equal(st.counters.appends, TEST_ENTRIES - 1);
+  assert_int_equal(st.counters.descents, 0);
+  assert_int_equal(st.counters.leaf_splits, st.leaves - 1);
+  /* each level above the leaves started as a new root */
+  assert_int_equal(st.counters.inner_splits, st.inners - (st.height - 1));
+  assert_int_equal(st.entries, TEST_ENTRIES);
+  assert_int_equal(st.chain_length, st.leaves);
+  assert_int_equal(st.node_bytes, st.leaves * sizeof(statstree_leaf) +
+                                      st.inners * sizeof(statstree_inner));
+  /* appends leave every leaf but the last full */
+  assert_true(st.leaf_hist[BTREE_FILL_BUCKETS - 1] >= st.leaves - 1);
+  size_t leaves = 0, inners = 0;
+  for (int b = 0; b < BTREE_FILL_BUCKETS; ++b)
+    leaves += st.leaf_hist[b], inners += st.inner_hist[b];
+  assert_int_equal(leaves, st.leaves);
+  assert_int_equal(inners, st.inners);
+  assert_true(st.leaf_fill > 0.9 && st.leaf_fill <= 1.0);
+  assert_true(st.inner_fill > 0.5 && st.inner_fill <= 1.0);
+
+  /* every search descends through height-1 internal nodes */
+  memset(&tree.counters, 0, sizeof(tree.counters));
+  for (int i = 0; i < TEST_ENTRIES; ++i)
+    assert_ptr_equal(statstree_search(&tree, i), &entries[i]);
+  statstree_iterate(&tree, intintree_get_entry_string, &(long long){0});
+  statstree_stats(&tree, &st);
+  assert_int_equal(st.counters.searches, TEST_ENTRIES);
+  assert_int_equal(st.counters.descents, TEST_ENTRIES);
+  assert_int_equal(st.counters.inner_visits,
+                   (unsigned long long)TEST_ENTRIES * (st.height - 1));
+  assert_true(st.counters.comparisons >= st.counters.inner_visits);
+  assert_int_equal(st.counters.iterate_leaves, st.leaves);
+  statstree_destroy(&tree);
+
+  /* without BTREE_OPT_STATS the counters never move */
+  intinttree plain;
+  intinttree_init(&plain);
+  for (int i = 0; i < TEST_ENTRIES; ++i)
+    intinttree_insert(&plain, &entries[i]);
+  intinttree_search(&plain, 1);
+  intinttree_stats(&plain, &st);
+  assert_int_equal(st.counters.inserts, 0);
+  assert_int_equal(st.counters.searches, 0);
+  assert_int_equal(st.entries, TEST_ENTRIES);
+  intinttree_destroy(&plain);
+}
+
+static void test_b_plus_tree_snapshot(void **_) {
+  static IntIntBPlusTree entries[TEST_ENTRIES];
+  const size_t           sizes[] = {0, 1, 2, 7, TEST_ENTRIES};
+  for (size_t z = 0; z < sizeof(sizes) / sizeof(sizes[0]); ++z) {
+    int n = (int)sizes[z];
+    /* ORDER 3 gives the deepest packed tree; keys 0, 2, 4, ... with runs of
+     * three duplicates */
+    arenatree tree;
+    arenatree_init(&tree);
+    for (int i = 0; i < n; ++i) {
+      int key    = ((i * 7) % n) / 3 * 2;
+      entries[i] = (IntIntBPlusTree){.key = key, .value = i};
+      arenatree_insert(&tree, &entries[i]);
+    }
+    FILE *f = tmpfile();
+    assert_non_null(f);
+    int fd = fileno(f);
+    assert_int_equal(arenatree_snapshot_write(&tree, fd), 0);
+
+    arenatree_snapshot snap;
+    assert_int_equal(arenatree_snapshot_open(&snap, fd, true), 0);
+    assert_int_equal(snap.n, n);
+    for (int key = -1; key <= 2 * n / 3 + 2; ++key) {
+      const IntIntBPlusTree *hit = arenatree_snapshot_search(&snap, key);
+      if (arenatree_search(&tree, key))
+        assert_true(hit && hit->key == key);
+      else
+        assert_null(hit);
+      /* same range as a cursor over the live tree */
+      const IntIntBPlusTree *first;
+      size_t count = arenatree_snapshot_range(&snap, key, key + 3, &first);
+      size_t i     = 0;
+      BTREE_RANGE_FOREACH(arenatree, &tree, key, key + 3, c) {
+        assert_true(i < count);
+        assert_int_equal(first[i].key, arenatree_cursor_entry(&c)->key);
+        assert_int_equal(first[i].value, arenatree_cursor_entry(&c)->value);
+        ++i;
+      }
+      assert_int_equal(i, count);
+    }
+    arenatree_snapshot_close(&snap);
+
+    /* another instantiation refuses the file */
+    pagetree_snapshot other;
+    assert_int_equal(pagetree_snapshot_open(&other, fd, true), -1);
+    assert_int_equal(errno, EINVAL);
+
+    /* a flipped body byte is caught when verifying */
+    if (n) {
+      unsigned char byte;
+      off_t         off = (off_t)sizeof(btree_snap_header);
+      assert_int_equal(pread(fd, &byte, 1, off), 1);
+      byte ^= 1;
+      assert_int_equal(pwrite(fd, &byte, 1, off), 1);
+      assert_int_equal(arenatree_snapshot_open(&snap, fd, true), -1);
+      assert_int_equal(errno, EBADMSG);
+    }
+    fclose(f);
+    arenatree_destroy(&tree);
+  }
+}
+
+typedef struct {
+  long long sum;
+  int       count, lo, hi;
+  bool      ordered;
+} scan_acc;
+
+static void scan_visit(IntIntBPlusTree *e, void *acc, void *ctx) {
+  scan_acc *a = acc;
+  if (a->count && e->key < a->hi) a->ordered = false;
+  if (!a->count) a->lo = e->key;
+  a->hi = e->key;
+  a->sum += e->value;
+  a->count++;
+}
+
+/* not commutative: ranges must arrive in key order */
+static void scan_merge(void *into, const void *from, void *ctx) {
+  scan_acc       *a = into;
+  const scan_acc *b = from;
+  ++*(int *)ctx;
+  if (!b->count) return;
+  if (a->count && b->lo < a->hi) a->ordered = false;
+  if (!a->count) a->lo = b->lo;
+  a->hi = b->hi;
+  a->sum += b->sum;
+  a->count += b->count;
+  a->ordered = a->ordered && b->ordered;
+}
+
+static void test_b_plus_tree_parallel(void **_) {
+  static IntIntBPlusTree  entries[TEST_ENTRIES];
+  static IntIntBPlusTree *sorted[TEST_ENTRIES];
+  long long               total = 0;
+  for (int i = 0; i < TEST_ENTRIES; ++i) {
+    entries[i] = (IntIntBPlusTree){.key = i / 2, .value = i};
+    sorted[i]  = &entries[i];
+    total += i;
+  }
+
+  const int      threads[] = {1, 2, 3, 8, 64};
+  const scan_acc identity  = {.ordered = true};
+  for (size_t k = 0; k < sizeof(threads) / sizeof(threads[0]); ++k) {
+    arenatree  small;
+    intinttree tree;
+    arenatree_init(&small);
+    intinttree_init(&tree);
+    scan_acc out;
+    int      merges = 0;
+    assert_int_equal(arenatree_parallel_scan(&small, threads[k],
+                                             sizeof(scan_acc), &identity,
+                                             scan_visit, scan_merge, &merges,
+                                             &out),
+                     0);
+    assert_int_equal(out.count, 0);
+
+    assert_int_equal(arenatree_bulk_load_parallel(&small, sorted,
+                                                  TEST_ENTRIES, 1.0,
+                                                  threads[k]),
+                     0);
+    assert_int_equal(check_tree(&small), TEST_ENTRIES);
+    assert_int_equal(intinttree_bulk_load_parallel(&tree, sorted,
+                                                   TEST_ENTRIES, 0.7,
+                                                   threads[k]),
+                     0);
+    int next = 0;
+    intinttree_iterate(&tree, count_value_order, &next);
+    assert_int_equal(next, TEST_ENTRIES);
+
+    merges = 0;
+    assert_int_equal(arenatree_parallel_scan(&small, threads[k],
+                                             sizeof(scan_acc), &identity,
+                                             scan_visit, scan_merge, &merges,
+                                             &out),
+                     0);
+    assert_true(merges >= 1 && merges <= threads[k]);
+    assert_int_equal(out.count, TEST_ENTRIES);
+    assert_true(out.sum == total && out.ordered);
+    assert_int_equal(out.lo, 0);
+    assert_int_equal(out.hi, (TEST_ENTRIES - 1) / 2);
+    assert_int_equal(intinttree_parallel_scan(&tree, threads[k],
+                                              sizeof(scan_acc), &identity,
+                                              scan_visit, scan_merge, &merges,
+                                              &out),
+                     0);
+    assert_true(out.count == TEST_ENTRIES && out.sum == total && out.ordered);
+    arenatree_destroy(&small);
+    intinttree_destroy(&tree);
+  }
+
+  /* out of order input leaves the tree empty */
+  arenatree tree;
+  arenatree_init(&tree);
+  sorted[TEST_ENTRIES / 2] = &entries[0];
+  assert_int_equal(
+      arenatree_bulk_load_parallel(&tree, sorted, TEST_ENTRIES, 1.0, 4), -1);
+  assert_null(tree.root);
+  assert_int_equal(tree.leaf_arena.live, 0);
+  arenatree_destroy(&tree);
+  sorted[TEST_ENTRIES / 2] = &entries[TEST_ENTRIES / 2];
+
+  /* also between two leaves inside one slice, on a tree without an
+   * arena, where a leaf left out of the cleanup would leak */
+  intinttree plain;
+  size_t     nl  = intinttree_bulk_groups(TEST_ENTRIES, intinttree_LEAF_KEYS);
+  size_t     cut = TEST_ENTRIES / nl + (TEST_ENTRIES % nl > 0); /* leaf 1 */
+  intinttree_init(&plain);
+  sorted[cut] = &entries[0];
+  assert_int_equal(intinttree_bulk_load(&plain, sorted, TEST_ENTRIES, 1.0), -1);
+  assert_int_equal(
+      intinttree_bulk_load_parallel(&plain, sorted, TEST_ENTRIES, 1.0, 2), -1);
+  assert_null(plain.root);
+  intinttree_destroy(&plain);
+  sorted[cut] = &entries[cut];
+}
+
+static void strkey_order(StrEntry *e, void *ctx) {
+  const char **prev = ctx;
+  if (*prev) assert_true(strcmp(*prev, e->key) <= 0);
+  *prev = e->key;
+}
+
+static void test_b_plus_tree_strkeys(void **_) {
+  static char     keys[TEST_ENTRIES][48];
+  static StrEntry entries[TEST_ENTRIES];
+  assert_int_equal(strkeytree_ORDER, 3);
+  assert_int_equal(strkeytree_LEAF_KEYS, 3);
+
+  /* long shared prefixes, keys that differ only past the first 8 bytes
+   * after them, short keys, the empty key and duplicates */
+  for (int i = 0; i < TEST_ENTRIES; ++i) {
+    int r = (int)((unsigned)i * 7919u % TEST_ENTRIES);
+    switch (r % 4) {
+    case 0:
+      snprintf(keys[i], sizeof(keys[i]), "https://example.com/a/%d", r);
+      break;
+    case 1:
+      snprintf(keys[i], sizeof(keys[i]), "https://example.com/a/00000000%d",
+               r / 8);
+      break;
+    case 2:
+      snprintf(keys[i], sizeof(keys[i]), "%c%d", 'a' + r % 3, r);
+      break;
+    default:
+      snprintf(keys[i], sizeof(keys[i]), "%.*s", r % 7, "zzzzzzz");
+      break;
+    }
+    entries[i] = (StrEntry){.key = keys[i], .value = i};
+  }
+
+  strkeytree tree;
+  strkeytree_init(&tree);
+  assert_null(strkeytree_search(&tree, ""));
+  strkeytree_cursor c = strkeytree_lower_bound(&tree, "a");
+  assert_false(strkeytree_cursor_valid(&c));
+  for (int i = 0; i < TEST_ENTRIES; ++i)
+    assert_int_equal(strkeytree_insert(&tree, &entries[i]), 0);
+  assert_true(tree.seps.bytes > 0);
+
+  const char *prev = NULL;
+  strkeytree_iterate(&tree, strkey_order, &prev);
+  for (int i = 0; i < TEST_ENTRIES; ++i) {
+    StrEntry *e = strkeytree_search(&tree, keys[i]);
+    assert_non_null(e);
+    assert_string_equal(e->key, keys[i]);
+  }
+  assert_null(strkeytree_search(&tree, "https://example.com/a/"));
+  assert_null(strkeytree_search(&tree, "b"));
+
+  /* lower_bound against a linear count of smaller keys */
+  const char *probes[] = {"",  "a",          "b5", "https://example.com/a/0",
+                          "z", "zzzzzzzzzz", "{"};
+  for (size_t p = 0; p < sizeof(probes) / sizeof(probes[0]); ++p) {
+    int below = 0;
+    for (int i = 0; i < TEST_ENTRIES; ++i)
+      below += strcmp(keys[i], probes[p]) < 0;
+    int seen = 0;
+    for (c = strkeytree_lower_bound(&tree, probes[p]);
+         strkeytree_cursor_valid(&c); strkeytree_cursor_next(&c)) {
+      assert_true(strcmp(strkeytree_cursor_entry(&c)->key, probes[p]) >= 0);
+      ++seen;
+    }
+    assert_int_equal(seen, TEST_ENTRIES - below);
+  }
+
+  strkeytree_clear(&tree);
+  assert_null(tree.root);
+  assert_int_equal(tree.seps.bytes, 0);
+  strkeytree_destroy(&tree);
+}
+
+static void olc_order(IntIntBPlusTree *e, void *ctx) {
+  int *prev = ctx;
+  assert_true(e->key > prev[0]);
+  prev[0] = e->key;
+  prev[1]++;
+}
+
+#define OLC_WRITERS 4
+#define OLC_READERS 4
+
+typedef struct {
+  olctree         *tree;
+  IntIntBPlusTree *entries; /* key k at entries[k] */
+  int              id;      /* writers first, then readers */
+  int              errors;
+} olc_job;
+
+/* keys 3i are there throughout; writer w adds keys 3i+1 with i % writers
+ * == w and erases every other one; 3i+2 never goes in */
+static void *olc_worker(void *arg) {
+  olc_job         *job = arg;
+  olctree_thread   th;
+  IntIntBPlusTree *e   = job->entries;
+  if (olctree_attach(job->tree, &th)) {
+    job->errors++;
+    return NULL;
+  }
+  if (job->id < OLC_WRITERS) {
+    for (int i = job->id; i < TEST_ENTRIES; i += OLC_WRITERS) {
+      int k = 3 * i + 1;
+      job->errors += olctree_insert_or_get(&th, &e[k]) != &e[k];
+      job->errors += olctree_search(&th, k) != &e[k];
+    }
+    for (int i = job->id; i < TEST_ENTRIES; i += 2 * OLC_WRITERS)
+      job->errors += olctree_erase(&th, 3 * i + 1) != &e[3 * i + 1];
+  } else {
+    for (int round = 0; round < 20; ++round)
+      for (int i = 0; i < TEST_ENTRIES; ++i) {
+        job->errors += olctree_search(&th, 3 * i) != &e[3 * i];
+        job->errors += olctree_search(&th, 3 * i + 2) != NULL;
+      }
+  }
+  olctree_detach(&th);
+  return NULL;
+}
+
+static void test_b_plus_tree_olc(void **_) {
+  static IntIntBPlusTree entries[3 * TEST_ENTRIES];
+  static IntIntBPlusTree again;
+  for (int k = 0; k < 3 * TEST_ENTRIES; ++k)
+    entries[k] = (IntIntBPlusTree){.key = k, .value = k};
+
+  olctree        tree;
+  olctree_thread th;
+  olctree_init(&tree);
+  assert_int_equal(olctree_attach(&tree, &th), 0);
+  assert_null(olctree_search(&th, 0));
+  assert_null(olctree_erase(&th, 0));
+
+  for (int i = TEST_ENTRIES - 1; i >= 0; --i)
+    assert_ptr_equal(olctree_insert_or_get(&th, &entries[3 * i]),
+                     &entries[3 * i]);
+  again = (IntIntBPlusTree){.key = 3};
+  assert_ptr_equal(olctree_insert_or_get(&th, &again), &entries[3]);
+  for (int i = 0; i < TEST_ENTRIES; ++i) {
+    assert_ptr_equal(olctree_search(&th, 3 * i), &entries[3 * i]);
+    assert_null(olctree_search(&th, 3 * i + 1));
+  }
+  olctree_detach(&th);
+
+  olc_job jobs[OLC_WRITERS + OLC_READERS];
+  for (int j = 0; j < OLC_WRITERS + OLC_READERS; ++j)
+    jobs[j] = (olc_job){.tree = &tree, .entries = entries, .id = j};
+  btree_run_parallel(OLC_WRITERS + OLC_READERS, olc_worker, jobs,
+                     sizeof(olc_job));
+  for (int j = 0; j < OLC_WRITERS + OLC_READERS; ++j)
+    assert_int_equal(jobs[j].errors, 0);
+
+  /* in order, with every other writer key gone */
+  int seen[2] = {-1, 0};
+  olctree_iterate(&tree, olc_order, seen);
+  assert_int_equal(seen[1], TEST_ENTRIES + TEST_ENTRIES / 2);
+
+  /* emptying the tree unlinks leaves; the retired ones are freed by
+   * detach and destroy */
+  assert_int_equal(olctree_attach(&tree, &th), 0);
+  for (int k = 0; k < 3 * TEST_ENTRIES; ++k) {
+    IntIntBPlusTree *e = olctree_erase(&th, k);
+    assert_true(e == NULL || e == &entries[k]);
+  }
+  seen[0] = -1;
+  seen[1] = 0;
+  olctree_iterate(&tree, olc_order, seen);
+  assert_int_equal(seen[1], 0);
+  assert_ptr_equal(olctree_insert_or_get(&th, &entries[7]), &entries[7]);
+  assert_ptr_equal(olctree_search(&th, 7), &entries[7]);
+  olctree_detach(&th);
+  olctree_destroy(&tree);
+}
+
+#define OLC_ROOT_ROUNDS 200
+#define OLC_ROOT_KEYS   256
+
+typedef struct {
+  olctree         *tree;
+  IntIntBPlusTree *entries; /* key k at entries[k] */
+  _Atomic int     *done;
+  int              id; /* the writer first, then readers */
+  int              errors;
+} olc_root_job;
+
+/* the writer fills a tree holding keys 0, K and 2K in key order, so the
+ * root splits again and again; readers look up those three meanwhile */
+static void *olc_root_worker(void *arg) {
+  olc_root_job    *job = arg;
+  olctree_thread   th;
+  IntIntBPlusTree *e   = job->entries;
+  if (olctree_attach(job->tree, &th)) {
+    job->errors++;
+    if (!job->id) atomic_store(job->done, 1);
+    return NULL;
+  }
+  if (!job->id) {
+    for (int k = 1; k < 2 * OLC_ROOT_KEYS; ++k)
+      job->errors += olctree_insert_or_get(&th, &e[k]) != &e[k];
+    atomic_store(job->done, 1);
+  } else {
+    /* bounded, in case this runs on the caller before the writer */
+    for (int pass = 0; pass < 100 * OLC_ROOT_KEYS; ++pass) {
+      for (int k = 0; k <= 2 * OLC_ROOT_KEYS; k += OLC_ROOT_KEYS)
+        job->errors += olctree_search(&th, k) != &e[k];
+      if (atomic_load(job->done)) break;
+    }
+  }
+  olctree_detach(&th);
+  return NULL;
+}
+
+static void test_b_plus_tree_olc_root_split(void **_) {
+  static IntIntBPlusTree entries[2 * OLC_ROOT_KEYS + 1];
+  for (int k = 0; k <= 2 * OLC_ROOT_KEYS; ++k)
+    entries[k] = (IntIntBPlusTree){.key = k, .value = k};
+
+  for (int round = 0; round < OLC_ROOT_ROUNDS; ++round) {
+    olctree        tree;
+    olctree_thread th;
+    _Atomic int    done = 0;
+    olctree_init(&tree);
+    assert_int_equal(olctree_attach(&tree, &th), 0);
+    for (int k = 0; k <= 2 * OLC_ROOT_KEYS; k += OLC_ROOT_KEYS)
+      assert_ptr_equal(olctree_insert_or_get(&th, &entries[k]), &entries[k]);
+    olctree_detach(&th);
+
+    olc_root_job jobs[1 + OLC_READERS];
+    for (int j = 0; j <= OLC_READERS; ++j)
+      jobs[j] = (olc_root_job){
+          .tree = &tree, .entries = entries, .done = &done, .id = j};
+    btree_run_parallel(1 + OLC_READERS, olc_root_worker, jobs,
+                       sizeof(olc_root_job));
+    for (int j = 0; j <= OLC_READERS; ++j)
+      assert_int_equal(jobs[j].errors, 0);
+
+    int seen[2] = {-1, 0};
+    olctree_iterate(&tree, olc_order, seen);
+    assert_int_equal(seen[1], 2 * OLC_ROOT_KEYS + 1);
+    olctree_destroy(&tree);
+  }
+}
+
+/* check the subtree counts below n; returns the number of entries */
+static size_t check_counts(counttree_node *n) {
+  if (n->is_leaf) return (size_t)n->nkeys;
+  counttree_inner *in    = counttree_as_inner(n);
+  size_t           total = 0;
+  for (int i = 0; i <= n->nkeys; ++i) {
+    size_t below = check_counts(in->children[i]);
+    assert_int_equal(counttree_counts(in)[i], below);
+    total += below;
+  }
+  return total;
+}
+
+/* rank, select and count_range of both trees against copies[k], the
+ * number of entries with key k */
+static void check_order_stats(counttree *tree, intinttree *plain,
+                              const int *copies, int keys) {
+  size_t n = tree->root ? check_counts(tree->root) : 0;
+  size_t below[TEST_ENTRIES + 1];
+  below[0] = 0;
+  for (int k = 0; k < keys; ++k) below[k + 1] = below[k] + copies[k];
+  assert_int_equal(n, below[keys]);
+  for (int k = 0; k <= keys; ++k) {
+    assert_int_equal(counttree_rank(tree, k), below[k]);
+    assert_int_equal(intinttree_rank(plain, k), below[k]);
+  }
+  assert_int_equal(counttree_rank(tree, -1), 0);
+  for (int k = 0; k < keys; ++k)
+    for (size_t i = below[k]; i < below[k + 1]; ++i) {
+      assert_int_equal(counttree_select(tree, i)->key, k);
+      assert_int_equal(intinttree_select(plain, i)->key, k);
+    }
+  assert_null(counttree_select(tree, n));
+  assert_null(intinttree_select(plain, n));
+  for (int lo = 0; lo <= keys; lo += 7)
+    for (int hi = 0; hi <= keys; hi += 5) {
+      size_t want = lo < hi ? below[hi] - below[lo] : 0;
+      assert_int_equal(counttree_count_range(tree, lo, hi), want);
+      assert_int_equal(intinttree_count_range(plain, lo, hi), want);
+    }
+}
+
+static void test_b_plus_tree_order_stats(void **_) {
+  static IntIntBPlusTree  entries[TEST_ENTRIES];
+  static IntIntBPlusTree  again[TEST_ENTRIES];
+  static IntIntBPlusTree *sorted[TEST_ENTRIES];
+  static int              copies[TEST_ENTRIES];
+  const int               keys = TEST_ENTRIES / 2;
+
+  counttree  tree;
+  intinttree plain;
+  counttree_init(&tree);
+  intinttree_init(&plain);
+  check_order_stats(&tree, &plain, copies, keys);
+
+  /* scattered keys, each one twice */
+  for (int i = 0; i < TEST_ENTRIES; ++i) {
+    int key    = (i * 7) % TEST_ENTRIES / 2;
+    entries[i] = (IntIntBPlusTree){.key = key, .value = i};
+    assert_int_equal(counttree_insert(&tree, &entries[i]), 0);
+    assert_int_equal(intinttree_insert(&plain, &entries[i]), 0);
+    copies[key]++;
+  }
+  check_order_stats(&tree, &plain, copies, keys);
+
+  /* upsert replaces without changing the counts */
+  for (int k = 0; k < keys; k += 3) {
+    again[k] = (IntIntBPlusTree){.key = k, .value = -k};
+    assert_int_equal(counttree_upsert(&tree, &again[k], NULL), 0);
+  }
+  assert_int_equal(check_counts(tree.root), TEST_ENTRIES);
+
+  /* erasing merges and borrows */
+  for (int i = 0; i < TEST_ENTRIES; ++i) {
+    int key = (i * 13) % keys;
+    if (key % 3 == 0 || !copies[key]) continue;
+    assert_non_null(counttree_erase(&tree, key));
+    assert_non_null(intinttree_erase(&plain, key));
+    copies[key]--;
+  }
+  check_order_stats(&tree, &plain, copies, keys);
+  counttree_destroy(&tree);
+  intinttree_destroy(&plain);
+
+  /* ascending appends, then a bulk load */
+  for (int fill = 0; fill < 2; ++fill) {
+    counttree_init(&tree);
+    intinttree_init(&plain);
+    for (int k = 0; k < keys; ++k) {
+      entries[k] = (IntIntBPlusTree){.key = k, .value = k};
+      sorted[k]  = &entries[k];
+      copies[k]  = 1;
+    }
+    if (fill) {
+      assert_int_equal(counttree_bulk_load(&tree, sorted, keys, 0.7), 0);
+      assert_int_equal(intinttree_bulk_load(&plain, sorted, keys, 0.7), 0);
+    } else {
+      for (int k = 0; k < keys; ++k) {
+        assert_int_equal(counttree_insert(&tree, &entries[k]), 0);
+        assert_int_equal(intinttree_insert(&plain, &entries[k]), 0);
+      }
+    }
+    check_order_stats(&tree, &plain, copies, keys);
+    counttree_destroy(&tree);
+    intinttree_destroy(&plain);
+  }
+}
+
 int main(void) {
   const struct CMUnitTest tests[] = {
       cmocka_unit_test(test_b_plus_tree_init),
       cmocka_unit_test(test_b_plus_tree_insert),
       cmocka_unit_test(test_b_plus_tree_iterate),
+      cmocka_unit_test(test_b_plus_tree_clear),
+      cmocka_unit_test(test_b_plus_tree_arena),
+      cmocka_unit_test(test_b_plus_tree_insert_order),
+      cmocka_unit_test(test_b_plus_tree_bulk_load),
+      cmocka_unit_test(test_b_plus_tree_sized),
+      cmocka_unit_test(test_b_plus_tree_search_kernels),
+      cmocka_unit_test(test_b_plus_tree_cursor),
+      cmocka_unit_test(test_b_plus_tree_erase),
+      cmocka_unit_test(test_b_plus_tree_search_batch),
+      cmocka_unit_test(test_b_plus_tree_upsert),
+      cmocka_unit_test(test_b_plus_tree_stats),
+      cmocka_unit_test(test_b_plus_tree_snapshot),
+      cmocka_unit_test(test_b_plus_tree_parallel),
+      cmocka_unit_test(test_b_plus_tree_strkeys),
+      cmocka_unit_test(test_b_plus_tree_olc),
+      cmocka_unit_test(test_b_plus_tree_olc_root_split),
+      cmocka_unit_test(test_b_plus_tree_order_stats),
   };
 
   return cmocka_run_group_tests(tests, NULL, NULL);
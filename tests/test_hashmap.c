@@ -0,0 +1,234 @@
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <cmocka.h>
+
+#include "structures.h"
+#include "structures/hashmap/int_int_hashmap.h"
+
+#define TEST_ENTRIES 1000
+
+/* every key in one probe sequence with the same tag */
+#define HASH_SAME(k) ((void)(k), (uint64_t)0x2A)
+DEFINE_HASHMAP(collidemap, IntIntHashMap, int, key, HASH_SAME, EQ_INT)
+
+static void count_entries(IntIntHashMap *e, void *ctx) {
+  long long *sum = ctx;
+  sum[0]++;
+  sum[1] += e->key;
+}
+
+/* every entry is found, and iterate sees each of them once */
+static void check_map(intintmap *map, IntIntHashMap *entries, int n) {
+  long long sum[2] = {0, 0}, keys = 0;
+  assert_int_equal(intintmap_size(map), n);
+  for (int i = 0; i < n; ++i) {
+    assert_ptr_equal(intintmap_search(map, entries[i].key), &entries[i]);
+    keys += entries[i].key;
+  }
+  intintmap_iterate(map, count_entries, sum);
+  assert_int_equal(sum[0], n);
+  assert_int_equal(sum[1], keys);
+}
+
+static void test_hash_map_init(void **_) {
+  intintmap map;
+  intintmap_init(&map);
+
+  assert_null(map.cur.groups);
+  assert_int_equal(intintmap_size(&map), 0);
+  assert_null(intintmap_search(&map, 1));
+  assert_null(intintmap_erase(&map, 1));
+  intintmap_destroy(&map);
+}
+
+static void test_hash_map_ctrl(void **_) {
+  uint8_t ctrl[8] = {0x91,
+                     HASHMAP_CTRL_EMPTY,
+                     0x91,
+                     HASHMAP_CTRL_DELETED,
+                     0xFF,
+                     HASHMAP_CTRL_FULL,
+                     HASHMAP_CTRL_EMPTY,
+                     0x93};
+  uint64_t c = hashmap_ctrl_word(ctrl);
+  int      slots[8];
+  int      n = 0;
+
+  for (hashmap_mask m = hashmap_match_byte(c, 0x91); m; m &= m - 1)
+    slots[n++] = hashmap_mask_slot(m);
+  assert_int_equal(n, 2);
+  assert_int_equal(slots[0], 0);
+  assert_int_equal(slots[1], 2);
+
+  n = 0;
+  for (hashmap_mask m = hashmap_match_empty(c); m; m &= m - 1)
+    slots[n++] = hashmap_mask_slot(m);
+  assert_int_equal(n, 2);
+  assert_int_equal(slots[0], 1);
+  assert_int_equal(slots[1], 6);
+
+  /* the unused last byte never matches */
+  n = 0;
+  for (hashmap_mask m = hashmap_match_free(c); m; m &= m - 1)
+    slots[n++] = hashmap_mask_slot(m);
+  assert_int_equal(n, 3);
+  assert_int_equal(slots[2], 6);
+  n = 0;
+  for (hashmap_mask m = hashmap_match_full(c); m; m &= m - 1)
+    slots[n++] = hashmap_mask_slot(m);
+  assert_int_equal(n, 4);
+  assert_int_equal(slots[3], 5);
+  assert_int_equal(hashmap_match_byte(c, 0x93), 0);
+}
+
+static void test_hash_map_insert(void **_) {
+  static IntIntHashMap entries[TEST_ENTRIES];
+  static IntIntHashMap again[TEST_ENTRIES];
+  intintmap            map;
+  intintmap_init(&map);
+
+  for (int i = 0; i < TEST_ENTRIES; ++i) {
+    entries[i] = (IntIntHashMap){.key = i * 7919, .value = i};
+    again[i]   = (IntIntHashMap){.key = i * 7919, .value = -i};
+    assert_ptr_equal(intintmap_insert_or_get(&map, &entries[i]), &entries[i]);
+  }
+  check_map(&map, entries, TEST_ENTRIES);
+  assert_null(intintmap_search(&map, 1));
+
+  for (int i = 0; i < TEST_ENTRIES; ++i)
+    assert_ptr_equal(intintmap_insert_or_get(&map, &again[i]), &entries[i]);
+  assert_int_equal(intintmap_size(&map), TEST_ENTRIES);
+
+  for (int i = 0; i < TEST_ENTRIES; i += 2) {
+    IntIntHashMap *old = &again[i];
+    assert_int_equal(intintmap_upsert(&map, &again[i], &old), 0);
+    assert_ptr_equal(old, &entries[i]);
+  }
+  for (int i = 0; i < TEST_ENTRIES; ++i)
+    assert_ptr_equal(intintmap_search(&map, entries[i].key),
+                     i % 2 ? &entries[i] : &again[i]);
+
+  /* a new key goes in, old is NULL */
+  IntIntHashMap  extra = {.key = -1};
+  IntIntHashMap *old   = &extra;
+  assert_int_equal(intintmap_upsert(&map, &extra, &old), 0);
+  assert_null(old);
+  assert_ptr_equal(intintmap_search(&map, -1), &extra);
+  assert_int_equal(intintmap_size(&map), TEST_ENTRIES + 1);
+  intintmap_destroy(&map);
+}
+
+static void test_hash_map_resize(void **_) {
+  static IntIntHashMap entries[TEST_ENTRIES];
+  intintmap            map;
+  intintmap_init(&map);
+
+  /* growing keeps two tables for a while; every entry stays reachable
+   * after each insert, whichever table holds it */
+  int seen_old = 0;
+  for (int i = 0; i < TEST_ENTRIES; ++i) {
+    entries[i] = (IntIntHashMap){.key = i, .value = i};
+    assert_non_null(intintmap_insert_or_get(&map, &entries[i]));
+    if (map.old.groups) {
+      seen_old++;
+      assert_true(map.cur.growth_left >= map.old.size);
+    }
+    if (i % 97 == 0) check_map(&map, entries, i + 1);
+  }
+  assert_true(seen_old > 0);
+  check_map(&map, entries, TEST_ENTRIES);
+
+  /* erase while a move is under way */
+  while (!map.old.groups) {
+    static IntIntHashMap more[TEST_ENTRIES];
+    int                  n = (int)intintmap_size(&map) - TEST_ENTRIES;
+    assert_true(n < TEST_ENTRIES);
+    more[n] = (IntIntHashMap){.key = TEST_ENTRIES + n};
+    assert_non_null(intintmap_insert_or_get(&map, &more[n]));
+  }
+  for (int i = 0; i < TEST_ENTRIES; i += 2)
+    assert_ptr_equal(intintmap_erase(&map, i), &entries[i]);
+  for (int i = 0; i < TEST_ENTRIES; ++i)
+    assert_ptr_equal(intintmap_search(&map, i), i % 2 ? &entries[i] : NULL);
+
+  /* reserve finishes the move and makes room at once */
+  size_t size = intintmap_size(&map);
+  assert_int_equal(intintmap_reserve(&map, 4 * TEST_ENTRIES), 0);
+  assert_null(map.old.groups);
+  assert_true(map.cur.size + map.cur.growth_left >= 4 * TEST_ENTRIES);
+  assert_int_equal(intintmap_size(&map), size);
+  for (int i = 1; i < TEST_ENTRIES; i += 2)
+    assert_ptr_equal(intintmap_search(&map, i), &entries[i]);
+  intintmap_destroy(&map);
+}
+
+static void test_hash_map_erase(void **_) {
+  static IntIntHashMap entries[TEST_ENTRIES];
+  intintmap            map;
+  intintmap_init(&map);
+  assert_int_equal(intintmap_reserve(&map, TEST_ENTRIES), 0);
+  size_t groups = map.cur.mask + 1;
+
+  /* churn through many more keys than the map ever holds: tombstones are
+   * reused or purged, the table does not keep growing */
+  for (int round = 0; round < 20; ++round) {
+    for (int i = 0; i < TEST_ENTRIES; ++i) {
+      entries[i] = (IntIntHashMap){.key = round * TEST_ENTRIES + i};
+      assert_non_null(intintmap_insert_or_get(&map, &entries[i]));
+    }
+    check_map(&map, entries, TEST_ENTRIES);
+    for (int i = 0; i < TEST_ENTRIES; ++i)
+      assert_ptr_equal(intintmap_erase(&map, entries[i].key), &entries[i]);
+    assert_null(intintmap_erase(&map, entries[0].key));
+    assert_int_equal(intintmap_size(&map), 0);
+  }
+  assert_true(map.cur.mask + 1 <= 2 * groups);
+
+  intintmap_clear(&map);
+  assert_null(map.cur.groups);
+  assert_int_equal(intintmap_size(&map), 0);
+  intintmap_destroy(&map);
+}
+
+static void test_hash_map_collisions(void **_) {
+  static IntIntHashMap entries[100];
+  collidemap           map;
+  collidemap_init(&map);
+
+  /* one long probe sequence: matching tags but different keys */
+  for (int i = 0; i < 100; ++i) {
+    entries[i] = (IntIntHashMap){.key = i, .value = i};
+    assert_ptr_equal(collidemap_insert_or_get(&map, &entries[i]),
+                     &entries[i]);
+  }
+  for (int i = 0; i < 100; ++i)
+    assert_ptr_equal(collidemap_search(&map, i), &entries[i]);
+  assert_null(collidemap_search(&map, 100));
+
+  /* removing from the middle of the sequence keeps later keys reachable */
+  for (int i = 0; i < 100; i += 3)
+    assert_ptr_equal(collidemap_erase(&map, i), &entries[i]);
+  for (int i = 0; i < 100; ++i)
+    assert_ptr_equal(collidemap_search(&map, i), i % 3 ? &entries[i] : NULL);
+  for (int i = 0; i < 100; i += 3)
+    assert_ptr_equal(collidemap_insert_or_get(&map, &entries[i]),
+                     &entries[i]);
+  assert_int_equal(collidemap_size(&map), 100);
+  collidemap_destroy(&map);
+}
+
+int main(void) {
+  const struct CMUnitTest tests[] = {
+      cmocka_unit_test(test_hash_map_init),
+      cmocka_unit_test(test_hash_map_ctrl),
+      cmocka_unit_test(test_hash_map_insert),
+      cmocka_unit_test(test_hash_map_resize),
+      cmocka_unit_test(test_hash_map_erase),
+      cmocka_unit_test(test_hash_map_collisions),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}